@@ -26,6 +26,7 @@
 #include <arch/intel/intel.h>
 #include <print.h>
 #include <vmm.h>
+#include <pmm.h>
 
 struct i386_cpu master_cpu = { 0 };
 
@@ -37,6 +38,7 @@ static void identify_cpu(struct i386_cpu *cpu)
 
 	/* Determine the vendor of the CPU. */
 	cpuid(0, reg);
+	uint32_t max_basic = reg[0];
 	memcpy(&cpu->vendor[0], (char *)&reg[1], 4);
 	memcpy(&cpu->vendor[8], (char *)&reg[2], 4);
 	memcpy(&cpu->vendor[4], (char *)&reg[3], 4);
@@ -65,7 +67,7 @@ static void identify_cpu(struct i386_cpu *cpu)
 	cpu->cpuid_features_hi = reg[2];
 
 	if (cpu->cpuid_features_lo & i386_pae) {
-		klogc(swarn, "PAE supported and should be enabled.\n");
+		klogc(sinfo, "PAE supported.\n");
 	}
 
 	if (cpu->cpuid_features_lo & i386_psn) {
@@ -75,6 +77,56 @@ static void identify_cpu(struct i386_cpu *cpu)
 	if (cpu->cpuid_features_lo & i386_msr) {
 		klogc(sinfo, "Model specific register functionality available.\n");
 	}
+
+	/* Determine the cache geometry, so that frames can be colored by the cache
+	   sets they occupy. Each subleaf of leaf 4 describes one cache. Only data
+	   and unified caches matter, and the largest number of colors that can be
+	   used is taken from them. A cache whose ways span more than
+	   PMM_MAX_COLORS pages is skipped, as that many colors can not be held
+	   aside. On most processors this is the last level cache, which leaves
+	   the colors of the level below it. */
+	cpu->cache_colors = 1;
+	cpu->cache_ways = 1;
+	for (uint32_t i = 0; max_basic >= 4 && i < 16; ++i) {
+		cpuid_count(4, i, reg);
+		uint32_t type = reg[0] & 0x1F;
+		if (type == 0) {
+			break;
+		}
+		else if (type != 1 && type != 3) {
+			continue;
+		}
+
+		uint32_t level = (reg[0] >> 5) & 0x7;
+		uint32_t line = (reg[1] & 0xFFF) + 1;
+		uint32_t partitions = ((reg[1] >> 12) & 0x3FF) + 1;
+		uint32_t ways = (reg[1] >> 22) + 1;
+		uint32_t sets = reg[2] + 1;
+		uint32_t colors = (line * partitions * sets) / PAGE_SIZE;
+		if (colors > PMM_MAX_COLORS) {
+			klogc(sinfo, "L%d cache has %d page colors, which is too many to "
+				"use.\n", level, colors);
+		}
+		else if (colors > cpu->cache_colors) {
+			cpu->cache_colors = colors;
+			cpu->cache_ways = ways;
+		}
+	}
+
+	if (cpu->cache_colors > 1) {
+		klogc(sinfo, "Cache supports %d page colors of %d ways.\n",
+			cpu->cache_colors, cpu->cache_ways);
+	}
+}
+
+uint32_t arch_cache_colors(void)
+{
+	return master_cpu.cache_colors;
+}
+
+uint32_t arch_cache_ways(void)
+{
+	return master_cpu.cache_ways;
 }
 
 void init_i386_cpu(struct i386_cpu *cpu)
@@ -31,19 +31,158 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 
-#define PAGE_TABLE_TABLE	0x2		/* Index 2 */
-#define PAGE_DIR_TABLE		0x3		/* Index 3 */
+/* Every page table of the current context is visible within this window of the
+   linear address space, through a recursive mapping in the page directory. In
+   32-bit mode the window is a single page directory entry, whilst PAE requires
+   one entry for each of the four page directories. */
+#define PAGE_TABLE_WINDOW	0x00800000
+
+/* The frame table of the Physical Memory Manager is mapped here. */
+#define PAGE_FRAME_TABLE	0xC0000000
+
+/* Everything below this address belongs to the kernel, and is the same in
+   every context, with the exception of the page table window. The frame table
+   and temporary mapping slots are also shared. Everything else is private to
+   each context. */
+#define PAGE_KERNEL_LIMIT	0x40000000U
+
+/* The reverse map records where each frame is mapped. It has a head entry for
+   every frame that can be described by the frame table, followed by a pool of
+   mapping records. Both are only backed by frames once they are needed. */
+#define PAGE_RMAP_HEADS		0xE0000000
+#define PAGE_RMAP_RECORDS	0xE4000000
+#define PAGE_RMAP_FRAMES	0x01000000
+#define PAGE_RMAP_LARGE		0x1
+
+/* The number of contexts that can be created by cloning another. */
+#define PAGING_MAX_CONTEXTS	32
+
+#define PAGE_FRAME_MASK		0xFFFFF000ULL
+#define PAE_FRAME_MASK		0x000FFFFFFFFFF000ULL
+
+#define CR0_WP				(1 << 16)
+#define CR4_PSE				(1 << 4)
+#define CR4_PAE				(1 << 5)
+#define CR4_PGE				(1 << 7)
+
+/* Invalidations are collected into batches of this size. A batch containing
+   more invalidations than the threshold is cheaper to handle by flushing the
+   entire TLB. */
+#define PAGING_TLB_BATCH	64
+#define PAGING_TLB_THRESHOLD	16
 
 struct paging_context __kernel_paging_ctx = { 0 };
 paging_info_t kernel_paging_ctx = &__kernel_paging_ctx;
 
+/* The page directory pointer table must be below 4GiB, which the kernel image
+   satisfies. It is page aligned, as CR3 is only ever read back as a page
+   aligned address. */
+static uint64_t kernel_page_dir_pointers[4] __attribute__((
+	aligned(PAGE_SIZE)
+));
+
+/**
+ The layout of the paging structures for the chosen paging mode.
+ 	- pae			Physical address extensions are in use.
+ 	- large_pages	Large pages can be used.
+ 	- global_pages	Kernel pages are marked as global.
+ 	- shift			Number of bits of a linear address covered by a table.
+ 	- entries		Number of entries in each table.
+ 	- tables		Number of tables required to cover the address space.
+ 	- frame_mask	Mask of the frame address within an entry.
+ */
+static struct {
+	bool pae;
+	bool large_pages;
+	bool global_pages;
+	uint32_t shift;
+	uint32_t entries;
+	uint32_t tables;
+	uint64_t frame_mask;
+} paging = {
+	.pae = false,
+	.large_pages = false,
+	.global_pages = false,
+	.shift = 22,
+	.entries = 1024,
+	.tables = 1024,
+	.frame_mask = PAGE_FRAME_MASK,
+};
+
+/**
+ A batch of pending TLB invalidations. Any frame that was mapped at one of the
+ addresses is only released once the invalidation has happened, so it can not
+ be reused whilst a stale translation for it might still exist.
+ */
+struct paging_tlb_batch
+{
+	uint32_t count;
+	bool global;
+	struct {
+		uintptr_t linear;
+		paddr_t frame;
+		uint32_t order;
+	} entry[PAGING_TLB_BATCH];
+};
+
+/* Cloned contexts, each with a page directory pointer table that is within the
+   kernel image, and so below 4GiB and identity mapped. A context is in use if
+   it has a page directory. */
+static struct {
+	uint64_t page_dir_pointers[4];
+	struct paging_context ctx;
+} __attribute__((aligned(32))) paging_clones[PAGING_MAX_CONTEXTS];
+
+static struct paging_context *current_paging_ctx = &__kernel_paging_ctx;
+static uintptr_t current_cr3 = 0;
+
+/**
+ A single mapping of a frame in the reverse map. Records are identified by
+ their index in the pool, with index 0 meaning no record.
+ 	- linear	The linear address the frame is mapped at, which also holds
+ 				PAGE_RMAP_LARGE if the frame begins a large page.
+ 	- ctx		The context in which the mapping exists.
+ 	- next		The next mapping of the same frame.
+ */
+struct paging_rmap_record
+{
+	uintptr_t linear;
+	struct paging_context *ctx;
+	uint32_t next;
+};
+
+static struct {
+	bool ready;
+	uint32_t free;
+	uint32_t count;
+} rmap = { 0 };
+
+static struct paging_tlb_stats tlb_stats = { 0 };
+static paging_fault_handler_t fault_handler = NULL;
+
+#define LARGE_PAGE_SIZE		(1UL << paging.shift)
+#define LARGE_PAGE_MASK		((paddr_t)LARGE_PAGE_SIZE - 1)
+#define PAGE_TEMP_TABLE		(paging.tables - 1)	/* Temporary mapping slots */
+
 ////////////////////////////////////////////////////////////////////////////////
 
 bool page_is_mapped(paging_info_t info, uintptr_t linear);
+static bool paging_copy_on_write(uintptr_t linear);
 static void page_fault_handler(struct i386_interrupt_frame *frame)
 {
 	/* Determine what to do with the fault. If nothing is done, then panic. */
-	if (frame->errc & 0x01) {
+	bool write = (frame->errc & 0x02) != 0;
+	if ((frame->errc & 0x01) && write && paging_copy_on_write(get_cr2())) {
+		/* A write to a shared page, which now has its own copy. */
+		return;
+	}
+	else if ((frame->errc & 0x01) && write
+		&& fault_handler && fault_handler(get_cr2(), true)
+	) {
+		/* A write to a read only page that the handler has replaced. */
+		return;
+	}
+	else if (frame->errc & 0x01) {
 		/* The error is a page-protection violation. */
 		panic(
 			"Illegal Page Access", 
@@ -52,7 +191,8 @@ static void page_fault_handler(struct i386_interrupt_frame *frame)
 	}
 	else {
 		/* Page is not present. Should it be created? */
-		if (page_is_mapped(kernel_paging_ctx, get_cr2())) {
+		uintptr_t linear = get_cr2();
+		if (page_is_mapped(kernel_paging_ctx, linear)) {
 			panic(
 				"Page is mapped, but not present?",
 				"An attempt to access page (%p) which was not mapped into the\n"
@@ -60,6 +200,10 @@ static void page_fault_handler(struct i386_interrupt_frame *frame)
 				get_cr2(), frame->eip
 			);
 		}
+		else if (fault_handler && fault_handler(linear, write)) {
+			/* The page has been mapped, so the access can be retried. */
+			return;
+		}
 		else {
 			panic(
 				"Page Not Present",
@@ -76,32 +220,187 @@ static void page_fault_handler(struct i386_interrupt_frame *frame)
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static inline void idmap(paging_info_t info, enum frame_purpose purpose)
+static inline uint64_t paging_entry(void *table, uint32_t i)
 {
-	uintptr_t start, end;
-	pmm_frame_range(purpose, &start, &end);
-	for (uintptr_t addr = start; addr < end; addr += PAGE_SIZE) {
-		paging_map(info, addr, addr);
+	return paging.pae 
+		? ((volatile uint64_t *)table)[i] 
+		: ((volatile uint32_t *)table)[i];
+}
+
+static inline void paging_set_entry(void *table, uint32_t i, uint64_t entry)
+{
+	if (!paging.pae) {
+		((volatile uint32_t *)table)[i] = (uint32_t)entry;
+		return;
 	}
+
+	/* PAE entries are 64-bits wide, and must be replaced with a single write
+	   so that the processor never observes half of an update. */
+	volatile uint64_t *ptr = &((uint64_t *)table)[i];
+	uint64_t old = *ptr;
+	__asm__ volatile(
+		"1: lock cmpxchg8b %0\n"
+		"   jnz 1b"
+		: "+m"(*ptr), "+A"(old)
+		: "b"((uint32_t)entry), "c"((uint32_t)(entry >> 32))
+		: "memory", "cc"
+	);
+}
+
+static inline paddr_t paging_entry_frame(uint64_t entry)
+{
+	return (paddr_t)(entry & paging.frame_mask);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static inline void paging_tlb_invalidate(bool full_shootdown, uintptr_t linear)
+static inline bool paging_is_global(uintptr_t linear)
 {
-	if (!paging_is_enabled())
+	/* Kernel translations are shared by every context, so they can be kept in
+	   the TLB when CR3 is reloaded. The page table window and the temporary
+	   slots are specific to a context and must never be global. */
+	if (!paging.global_pages) {
+		return false;
+	}
+	else if (linear >= PAGE_TABLE_WINDOW
+		&& linear < PAGE_TABLE_WINDOW + (paging.tables * PAGE_SIZE)
+	) {
+		return false;
+	}
+	else if (linear < PAGE_KERNEL_LIMIT) {
+		return true;
+	}
+	return linear >= PAGE_FRAME_TABLE 
+		&& (linear >> paging.shift) < PAGE_TEMP_TABLE;
+}
+
+static inline uint64_t paging_page_flags(uintptr_t linear)
+{
+	uint64_t flags = page_present | page_write;
+	if (paging_is_global(linear)) {
+		flags |= page_global;
+	}
+	return flags;
+}
+
+static inline void idmap(paging_info_t info, uintptr_t start, uintptr_t end)
+{
+	/* When large pages are available, every large page that the range touches
+	   is identity mapped as a whole. This also maps some neighbouring frames,
+	   but those are only ever accessed through their own mappings. */
+	if (paging.large_pages) {
+		start &= ~(LARGE_PAGE_SIZE - 1);
+		for (uintptr_t addr = start; addr < end; addr += LARGE_PAGE_SIZE) {
+			if (!page_is_large(info, addr)) {
+				paging_map_large(info, addr, addr);
+			}
+		}
 		return;
-	
-	if (full_shootdown) {
-		set_cr3(get_cr3());
 	}
 
-	__asm__ volatile("invlpg %0" :: "m"((void *)linear));
+	paging_map_range(info, start, start, (end - start) / PAGE_SIZE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/* The processor never caches a translation for a page that is not present, so
+   entries only need to be invalidated when they are changed or removed. Adding
+   a new entry does not require any invalidation. */
+
+static inline void paging_tlb_invalidate(uintptr_t linear)
+{
+	if (!paging_is_enabled())
+		return;
+
+	__asm__ volatile("invlpg %0" :: "m"(*(char *)linear) : "memory");
+	tlb_stats.invalidations++;
 }
 
 void paging_flush(void)
 {
-	paging_tlb_invalidate(true, 0x0);
+	if (!paging_is_enabled())
+		return;
+
+	set_cr3(current_cr3);
+	tlb_stats.full_flushes++;
+}
+
+static void paging_flush_global(void)
+{
+	if (!paging_is_enabled())
+		return;
+	else if (!paging.global_pages) {
+		paging_flush();
+		return;
+	}
+
+	/* Reloading CR3 leaves global pages in the TLB. Toggling CR4.PGE is the
+	   only way to remove all of them at once. */
+	uint32_t cr4 = get_cr4();
+	set_cr4(cr4 & ~CR4_PGE);
+	set_cr4(cr4);
+	tlb_stats.full_flushes++;
+	tlb_stats.global_flushes++;
+}
+
+static void paging_tlb_commit(struct paging_tlb_batch *batch)
+{
+	if (batch->count == 0) {
+		return;
+	}
+
+	if (batch->count > PAGING_TLB_THRESHOLD && batch->global) {
+		paging_flush_global();
+	}
+	else if (batch->count > PAGING_TLB_THRESHOLD) {
+		paging_flush();
+	}
+	else {
+		for (uint32_t i = 0; i < batch->count; ++i) {
+			paging_tlb_invalidate(batch->entry[i].linear);
+		}
+	}
+	tlb_stats.batches++;
+
+	/* No stale translations remain, so the frames can now be released. */
+	for (uint32_t i = 0; i < batch->count; ++i) {
+		paddr_t frame = batch->entry[i].frame;
+		uint32_t order = batch->entry[i].order;
+		if (frame == 0) {
+			continue;
+		}
+		else if (order == 0) {
+			pmm_release_frame(frame);
+		}
+		else {
+			pmm_release_frames(frame, order);
+		}
+	}
+	batch->count = 0;
+	batch->global = false;
+}
+
+static void paging_tlb_defer(
+	struct paging_tlb_batch *batch, uintptr_t linear, paddr_t frame,
+	uint32_t order
+) {
+	if (batch->count >= PAGING_TLB_BATCH) {
+		paging_tlb_commit(batch);
+	}
+
+	batch->entry[batch->count].linear = linear;
+	batch->entry[batch->count].frame = frame;
+	batch->entry[batch->count].order = order;
+	batch->global |= paging_is_global(linear);
+	batch->count++;
+	tlb_stats.deferred++;
+}
+
+void paging_get_tlb_stats(struct paging_tlb_stats *stats)
+{
+	if (stats) {
+		*stats = tlb_stats;
+	}
 }
 
 bool paging_is_supported(void)
@@ -128,69 +427,157 @@ oserr paging_set_context(paging_info_t info)
 		return e_fail;
 	}
 
+	/* In PAE mode the processor is given the page directory pointer table,
+	   rather than the page directory itself. */
 	struct paging_context *ctx = info;
-	if (ctx->page_dir_physical & 0xFFF) {
+	uintptr_t cr3 = paging.pae
+		? ctx->page_dir_pointers
+		: (uintptr_t)ctx->page_dir_physical;
+	if (cr3 & (paging.pae ? 0x1F : 0xFFF)) {
 		klogc(
-			swarn, "Page directory is not correctly aligned! %p\n", 
-			ctx->page_dir_physical
+			swarn, "Page directory is not correctly aligned! %p\n", cr3
 		);
 		return e_fail;
 	}
 
 	/* Set the CR3 register to the page directory for the given context */
-	set_cr3(ctx->page_dir_physical);
+	current_paging_ctx = ctx;
+	current_cr3 = cr3;
+	set_cr3(cr3);
+	return e_ok;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+static uintptr_t paging_address_for_directory(paging_info_t info);
+
 static uintptr_t paging_address_for_table(paging_info_t info, uint32_t table)
 {
-	struct paging_context *ctx = (void *)info;
-	return paging_is_enabled()
-		? (uintptr_t)(PAGE_TABLE_TABLE << 22) + (table << 12)
-		: (uintptr_t)(
-			((union page_table *)ctx->page_dir_physical)[table].s.frame << 12
-		  );
+	if (paging_is_enabled()) {
+		return (uintptr_t)PAGE_TABLE_WINDOW + (table << 12);
+	}
+
+	/* Before paging is enabled, tables are accessed directly through their
+	   physical address. */
+	void *dir = (void *)paging_address_for_directory(info);
+	return (uintptr_t)paging_entry_frame(paging_entry(dir, table));
 }
 
 static uintptr_t paging_address_for_directory(paging_info_t info)
 {
+	/* The page directory appears in the window as the tables that map the
+	   window itself. In PAE mode all four page directories are contiguous, so
+	   they can be treated as a single directory. */
 	struct paging_context *ctx = (void *)info;
 	return paging_is_enabled()
-		? paging_address_for_table(info, PAGE_TABLE_TABLE)
-		: ctx->page_dir_physical;
+		? paging_address_for_table(info, PAGE_TABLE_WINDOW >> paging.shift)
+		: (uintptr_t)ctx->page_dir_physical;
 }
 
 static inline void paging_translate_linear(
 	uintptr_t linear, uint32_t *pd, uint32_t *pt
 ) {
-	/* Translate a linear address into page directory and page table indexes. */
-	*pd = (linear >> 22) & 0x3FF;
-	*pt = (linear >> 12) & 0x3FF;
+	/* Translate a linear address into page directory and page table indexes.
+	   In PAE mode the directory index selects one of all four directories. */
+	*pd = linear >> paging.shift;
+	*pt = (linear >> 12) & (paging.entries - 1);
 }
 
 static inline uintptr_t paging_translate_index(uint32_t pd, uint32_t pt)
 {
 	/* Translate a set of page directory and page table indexes to a linear
 	   address. */
-	return ((pd & 0x3FF) << 22) | ((pt & 0x3FF) << 12);
+	return (pd << paging.shift) | ((pt & (paging.entries - 1)) << 12);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+static inline bool paging_is_window_table(uint32_t pd)
+{
+	uint32_t window = PAGE_TABLE_WINDOW >> paging.shift;
+	return pd >= window && pd < window + (paging.pae ? 4 : 1);
+}
+
+static inline bool paging_is_shared_table(uint32_t pd)
+{
+	if (paging_is_window_table(pd)) {
+		return false;
+	}
+	return pd < (PAGE_KERNEL_LIMIT >> paging.shift)
+		|| pd >= (PAGE_FRAME_TABLE >> paging.shift);
+}
+
+/* Set an entry of the page directory. Tables that are shared by every context
+   must have the same entry in each of their directories. */
+static void paging_set_directory_entry(
+	paging_info_t info, uint32_t pd, uint64_t entry
+) {
+	void *dir = (void *)paging_address_for_directory(info);
+	paging_set_entry(dir, pd, entry);
+
+	if (!paging_is_enabled() || !paging_is_shared_table(pd)) {
+		return;
+	}
+
+	uintptr_t flags = irq_save();
+	for (int32_t i = -1; i < PAGING_MAX_CONTEXTS; ++i) {
+		struct paging_context *ctx = (i < 0)
+			? &__kernel_paging_ctx
+			: &paging_clones[i].ctx;
+		if (ctx == current_paging_ctx || ctx->page_dir_physical == 0) {
+			continue;
+		}
+
+		/* The directory of a context that is not current is only reachable
+		   through its physical address. */
+		paddr_t frame = ctx->page_dir_physical;
+		frame += (paddr_t)(pd / paging.entries) * PAGE_SIZE;
+		void *other = (void *)paging_map_temporary(paging_slot_shared, frame);
+		paging_set_entry(other, pd % paging.entries, entry);
+		paging_unmap_temporary(paging_slot_shared);
+	}
+	irq_restore(flags);
+}
+
 bool page_is_mapped(paging_info_t info, uintptr_t linear)
 {
 	return (paging_linear_to_phys(info, linear, NULL) == e_ok);
 }
 
-oserr paging_phys_to_linear(paging_info_t info, uintptr_t frame, uintptr_t *a)
+bool page_is_large(paging_info_t info, uintptr_t linear)
 {
-	/* TODO */
-	klogc(swarn, "%s:%s is not implemented.\n", __FILE__, __FUNCTION__);
-	return e_fail;
+	uint32_t pd, pt;
+	paging_translate_linear(linear, &pd, &pt);
+
+	void *dir = (void *)paging_address_for_directory(info);
+	uint64_t entry = paging_entry(dir, pd);
+	return (entry & page_present) && (entry & page_large);
 }
 
-oserr paging_linear_to_phys(paging_info_t info, uintptr_t linear, uintptr_t *f)
+bool paging_has_large_pages(void)
+{
+	return paging.large_pages;
+}
+
+uint32_t paging_large_page_order(void)
+{
+	return paging.shift - 12;
+}
+
+bool paging_large_page_available(paging_info_t info, uintptr_t linear)
+{
+	if (!paging.large_pages || (linear & (LARGE_PAGE_SIZE - 1))) {
+		return false;
+	}
+
+	uint32_t pd, pt;
+	paging_translate_linear(linear, &pd, &pt);
+
+	void *dir = (void *)paging_address_for_directory(info);
+	return !(paging_entry(dir, pd) & page_present);
+}
+
+oserr paging_linear_to_phys(paging_info_t info, uintptr_t linear, paddr_t *f)
 {
 	/* Check if the page exists. If it does not look up the phyiscal frame */
 
@@ -199,24 +586,32 @@ oserr paging_linear_to_phys(paging_info_t info, uintptr_t linear, uintptr_t *f)
 	uint32_t pd, pt;
 	paging_translate_linear(linear, &pd, &pt);
 
-	/* Fetch the current page directory and page table for the page context. */
-	struct paging_context *ctx = info;
-	union page_table *dir = (void *)paging_address_for_directory(info);
+	/* Fetch the current page directory for the page context. */
+	void *dir = (void *)paging_address_for_directory(info);
+	uint64_t entry = paging_entry(dir, pd);
 
 	/* Check if the page table exists in the page directory. */
-	if (!dir[pd].s.present) {
+	if (!(entry & page_present)) {
 		return e_fail;
 	}
 
+	/* Large pages are mapped directly by the page directory, so there is no
+	   page table to look in. */
+	if (entry & page_large) {
+		paddr_t frame = paging_entry_frame(entry) & ~LARGE_PAGE_MASK;
+		if (f) *f = frame + ((paddr_t)pt << 12);
+		return e_ok;
+	}
+
 	/* Check if the page exists in the page table */
-	union page *table = (void *)paging_address_for_table(info, pd);
-	if (!table[pt].s.present) {
-		// klogc(sinfo, "Page %d does not exist in page table %d.\n", pt, pd);
+	void *table = (void *)paging_address_for_table(info, pd);
+	entry = paging_entry(table, pt);
+	if (!(entry & page_present)) {
 		return e_fail;
 	}
 
 	/* The page exists. */
-	if (f) *f = (table[pt].s.frame << 12);
+	if (f) *f = paging_entry_frame(entry);
 	return e_ok;
 }
 
@@ -224,10 +619,9 @@ oserr paging_linear_to_phys(paging_info_t info, uintptr_t linear, uintptr_t *f)
 
 static oserr paging_create_table(paging_info_t info, uint32_t table)
 {
-	struct paging_context *ctx = (void *)info;
-	union page_table *dir = (void *)paging_address_for_directory(info);
+	void *dir = (void *)paging_address_for_directory(info);
 
-	if (dir[table].s.present) {
+	if (paging_entry(dir, table) & page_present) {
 		/* The page is already present. This operation would be potentially
 		   fatal to the operation of the system. */
 		klogc(
@@ -242,60 +636,253 @@ static oserr paging_create_table(paging_info_t info, uint32_t table)
 	);
 
 	/* Acquire a new frame for use in the table. */
-	uintptr_t table_frame;
-	if (table == PAGE_TABLE_TABLE && !paging_is_enabled()) {
-		/* This is a special scenario. */
-		table_frame = ctx->page_dir_physical;
+	paddr_t table_frame = pmm_acquire_colored_frame(PMM_COLOR_DIVERSE);
+	pmm_set_frame_purpose(table_frame, frame_paging);
+
+	/* The directory entry also places the table into the page table window,
+	   as the directory doubles as the table for the window. The table is
+	   cleared before any other context is able to see it. */
+	paging_set_entry(
+		dir, table, table_frame | page_present | page_write
+	);
+	memset((void *)paging_address_for_table(info, table), 0, PAGE_SIZE);
+	paging_set_directory_entry(
+		info, table, table_frame | page_present | page_write
+	);
+
+	/* At this point we know everything succeed correctly. */
+	return e_ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/* Back the page of the reverse map at _linear_ with a cleared frame. This does
+   not use paging_map, as that would need to update the reverse map itself. */
+static oserr paging_rmap_back(uintptr_t linear)
+{
+	linear &= ~(PAGE_SIZE - 1);
+	if (page_is_mapped(current_paging_ctx, linear)) {
+		return e_ok;
 	}
-	else {
-		table_frame = pmm_acquire_frame();
+
+	uint32_t pd, pt;
+	paging_translate_linear(linear, &pd, &pt);
+	void *dir = (void *)paging_address_for_directory(current_paging_ctx);
+	if (!(paging_entry(dir, pd) & page_present)
+		&& paging_create_table(current_paging_ctx, pd) != e_ok
+	) {
+		return e_fail;
 	}
-	dir[table].s.present = 1;
-	dir[table].s.write = 1;
-	dir[table].s.frame = table_frame >> 12;
 
-	/* Ensure the required page tables exist. */
-	if (!dir[PAGE_TABLE_TABLE].s.present) {
-		/* We do not yet have the page table for tracking page tables. We must
-		   get it set up in order to proceed. */
-		if (paging_create_table(info, PAGE_TABLE_TABLE) != e_ok) {
-			panic(
-				"Fatal Error",
-				"Failed to setup a page table (%d) to host page tables. "
-				"This is considered an unrecoverable error, and the system has "
-				"been halted.",
-				PAGE_TABLE_TABLE
-			);
+	paddr_t frame = pmm_acquire_colored_frame(PMM_COLOR_DIVERSE);
+	pmm_set_frame_purpose(frame, frame_paging);
+	void *table = (void *)paging_address_for_table(current_paging_ctx, pd);
+	paging_set_entry(table, pt, frame | paging_page_flags(linear));
+	memset((void *)linear, 0, PAGE_SIZE);
+	return e_ok;
+}
+
+/* Mappings in memory that is shared by every context are recorded against the
+   kernel context. */
+static inline struct paging_context *paging_rmap_owner(uintptr_t linear)
+{
+	return paging_is_shared_table(linear >> paging.shift)
+		? &__kernel_paging_ctx
+		: current_paging_ctx;
+}
+
+static inline struct paging_rmap_record *paging_rmap_record(uint32_t index)
+{
+	return ((struct paging_rmap_record *)PAGE_RMAP_RECORDS) + index;
+}
+
+static uint32_t *paging_rmap_head(paddr_t frame, bool create)
+{
+	paddr_t pfn = frame >> 12;
+	if (!rmap.ready || pfn >= PAGE_RMAP_FRAMES) {
+		return NULL;
+	}
+
+	uintptr_t head = PAGE_RMAP_HEADS + ((uintptr_t)pfn * sizeof(uint32_t));
+	if (!page_is_mapped(current_paging_ctx, head)
+		&& (!create || paging_rmap_back(head) != e_ok)
+	) {
+		return NULL;
+	}
+	return (uint32_t *)head;
+}
+
+static void paging_rmap_insert(
+	struct paging_context *ctx, paddr_t frame, uintptr_t linear, uint32_t flags
+) {
+	/* Pinned frames, such as the zero page, are never reclaimed and can have
+	   a vast number of mappings, so they are not recorded. */
+	if (!rmap.ready || (pmm_frame_flags(frame) & frame_pinned)) {
+		return;
+	}
+
+	uintptr_t irq = irq_save();
+	uint32_t *head = paging_rmap_head(frame, true);
+	uint32_t index = 0;
+	if (head && rmap.free != 0) {
+		index = rmap.free;
+		rmap.free = paging_rmap_record(index)->next;
+	}
+	else if (head) {
+		/* A record can straddle two pages of the pool. */
+		uintptr_t start = (uintptr_t)paging_rmap_record(rmap.count + 1);
+		uintptr_t end = start + sizeof(struct paging_rmap_record) - 1;
+		uintptr_t limit = paging_translate_index(PAGE_TEMP_TABLE, 0);
+		if (end < limit
+			&& paging_rmap_back(start) == e_ok && paging_rmap_back(end) == e_ok
+		) {
+			index = ++rmap.count;
 		}
 	}
 
-	/* We're going to map the page table into the appropriate location of the 
-	   virtual address space. */
-	union page *page_table = (void *)paging_address_for_table(
-		info, PAGE_TABLE_TABLE
-	);
+	if (index == 0) {
+		irq_restore(irq);
+		klogc(swarn, "Unable to record mapping of frame %llx\n", frame);
+		return;
+	}
 
-	page_table[table].s.present = 1;
-	page_table[table].s.write = 1;
-	page_table[table].s.frame = table_frame >> 12;
+	struct paging_rmap_record *record = paging_rmap_record(index);
+	record->linear = (linear & ~(PAGE_SIZE - 1)) | flags;
+	record->ctx = ctx;
+	record->next = *head;
+	*head = index;
+	irq_restore(irq);
+}
 
-	paging_tlb_invalidate(true, (uintptr_t)page_table);
+static bool paging_rmap_remove(
+	struct paging_context *ctx, paddr_t frame, uintptr_t linear, uint32_t flags
+) {
+	bool removed = false;
+	uintptr_t irq = irq_save();
+	uint32_t *link = paging_rmap_head(frame, false);
+	linear = (linear & ~(PAGE_SIZE - 1)) | flags;
+	while (link && *link != 0) {
+		struct paging_rmap_record *record = paging_rmap_record(*link);
+		if (record->ctx == ctx && record->linear == linear) {
+			uint32_t index = *link;
+			*link = record->next;
+			record->next = rmap.free;
+			rmap.free = index;
+			removed = true;
+			break;
+		}
+		link = &record->next;
+	}
+	irq_restore(irq);
+	return removed;
+}
 
-	/* At this point we know everything succeed correctly. */
+/* Find the mappings of _frame_ that begin with the frame itself, copying up to
+   _max_ of them into _mappings_. Returns the total number of mappings. */
+static uint32_t paging_rmap_find(
+	paddr_t frame, uint32_t flags, struct paging_mapping *mappings,
+	uint32_t max
+) {
+	uint32_t count = 0;
+	uintptr_t irq = irq_save();
+	uint32_t *head = paging_rmap_head(frame, false);
+	uint32_t index = head ? *head : 0;
+	while (index != 0) {
+		struct paging_rmap_record *record = paging_rmap_record(index);
+		if ((record->linear & PAGE_RMAP_LARGE) == flags) {
+			if (count < max) {
+				mappings[count].info = record->ctx;
+				mappings[count].linear = record->linear & ~(PAGE_SIZE - 1);
+			}
+			count++;
+		}
+		index = record->next;
+	}
+	irq_restore(irq);
+	return count;
+}
+
+uint32_t paging_frame_mappings(
+	paddr_t frame, struct paging_mapping *mappings, uint32_t max
+) {
+	/* A frame is either mapped by itself, or as part of a large page. */
+	frame &= ~(paddr_t)(PAGE_SIZE - 1);
+	uint32_t count = paging_rmap_find(frame, 0, mappings, max);
+	if (paging.large_pages) {
+		paddr_t base = frame & ~LARGE_PAGE_MASK;
+		uint32_t first = MIN(count, max);
+		uint32_t large = paging_rmap_find(
+			base, PAGE_RMAP_LARGE, mappings + first, max - first
+		);
+		for (uint32_t i = first; i < MIN(count + large, max); ++i) {
+			mappings[i].linear += (uintptr_t)(frame - base);
+		}
+		count += large;
+	}
+	return count;
+}
+
+static bool paging_rmap_lookup(
+	paging_info_t info, paddr_t frame, uint32_t flags, uintptr_t *linear
+) {
+	bool found = false;
+	uintptr_t irq = irq_save();
+	uint32_t *head = paging_rmap_head(frame, false);
+	uint32_t index = head ? *head : 0;
+	while (index != 0 && !found) {
+		struct paging_rmap_record *record = paging_rmap_record(index);
+		bool shared = paging_is_shared_table(record->linear >> paging.shift);
+		if ((record->ctx == info || shared)
+			&& (record->linear & PAGE_RMAP_LARGE) == flags
+		) {
+			*linear = record->linear & ~(PAGE_SIZE - 1);
+			found = true;
+		}
+		index = record->next;
+	}
+	irq_restore(irq);
+	return found;
+}
+
+oserr paging_phys_to_linear(paging_info_t info, paddr_t frame, uintptr_t *a)
+{
+	uintptr_t linear = 0;
+	paddr_t identity = 0;
+	paddr_t page = frame & ~(paddr_t)(PAGE_SIZE - 1);
+	paddr_t base = frame & ~LARGE_PAGE_MASK;
+	if (paging_rmap_lookup(info, page, 0, &linear)) {
+		linear += (uintptr_t)(frame - page);
+	}
+	else if (paging.large_pages
+		&& paging_rmap_lookup(info, base, PAGE_RMAP_LARGE, &linear)
+	) {
+		linear += (uintptr_t)(frame - base);
+	}
+	else if (frame < 0x100000000ULL
+		&& paging_linear_to_phys(info, (uintptr_t)frame, &identity) == e_ok
+		&& identity == frame
+	) {
+		/* Memory that was mapped before the reverse map was available is
+		   identity mapped. */
+		linear = (uintptr_t)frame;
+	}
+	else {
+		return e_fail;
+	}
+
+	if (a) *a = linear;
 	return e_ok;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-oserr paging_map(paging_info_t info, uintptr_t frame, uintptr_t linear) 
-{
+static oserr paging_map_entry(
+	paging_info_t info, paddr_t frame, uintptr_t linear, bool writable
+) {
 	/* Locate the page table, enter the new page into it and ensure anything
 	   required along the way is constructed. If the page is already mapped
 	   then warn the user and ignore. */
-
-	bool tlb_shootdown_required = false;
-	struct paging_context *ctx = (void *)info;
-	union page_table *dir = (void *)paging_address_for_directory(info);
+	void *dir = (void *)paging_address_for_directory(info);
 
 	linear &= ~(PAGE_SIZE - 1);
 
@@ -308,7 +895,7 @@ oserr paging_map(paging_info_t info, uintptr_t frame, uintptr_t linear)
 	paging_translate_linear(linear, &pd, &pt);
 
 	/* Ensure the page table exists */
-	if (!dir[pd].s.present) {
+	if (!(paging_entry(dir, pd) & page_present)) {
 		/* The page table does not exist. Create it. */
 		if (paging_create_table(info, pd) != e_ok) {
 			/* Failed to create page table. */
@@ -318,15 +905,150 @@ oserr paging_map(paging_info_t info, uintptr_t frame, uintptr_t linear)
 	}
 
 	/* Locate the page table in memory so we can update it */
-	union page *page_table = (void *)paging_address_for_table(info, pd);
+	void *page_table = (void *)paging_address_for_table(info, pd);
 
 	/* Write in the new entry. */
-	page_table[pt].s.present = 1;
-	page_table[pt].s.write = 1;
-	page_table[pt].s.frame = frame >> 12;
+	uint64_t flags = paging_page_flags(linear);
+	if (!writable) {
+		flags &= ~(uint64_t)page_write;
+	}
+	paging_set_entry(page_table, pt, (frame & paging.frame_mask) | flags);
+	paging_rmap_insert(
+		paging_rmap_owner(linear), frame & paging.frame_mask, linear, 0
+	);
+
+	return e_ok;
+}
+
+oserr paging_map(paging_info_t info, paddr_t frame, uintptr_t linear) 
+{
+	return paging_map_entry(info, frame, linear, true);
+}
+
+oserr paging_map_readonly(paging_info_t info, paddr_t frame, uintptr_t linear)
+{
+	return paging_map_entry(info, frame, linear, false);
+}
+
+static oserr paging_split_large(
+	paging_info_t info, uint32_t pd, struct paging_tlb_batch *batch
+) {
+	void *dir = (void *)paging_address_for_directory(info);
+	uint64_t entry = paging_entry(dir, pd);
+	paddr_t frame = paging_entry_frame(entry) & ~LARGE_PAGE_MASK;
+	uint64_t flags = entry & (page_write | page_user | page_global);
+
+	paddr_t table_frame = pmm_acquire_colored_frame(PMM_COLOR_DIVERSE);
+	pmm_set_frame_purpose(table_frame, frame_paging);
+
+	/* Build the replacement page table before it is installed, so that none
+	   of the memory behind the large page is ever left unmapped. */
+	uintptr_t irq = irq_save();
+	void *table = (void *)paging_map_temporary(paging_slot_split, table_frame);
+	for (uint32_t pt = 0; pt < paging.entries; ++pt) {
+		paging_set_entry(
+			table, pt, (frame + ((paddr_t)pt << 12)) | flags | page_present
+		);
+	}
+	paging_unmap_temporary(paging_slot_split);
+
+	/* The entry must be replaced in a single write, as the large page could
+	   be hosting the code that is currently executing. */
+	paging_set_directory_entry(
+		info, pd, table_frame | (flags & ~page_global) | page_present
+	);
+
+	/* If the large page was known to the reverse map, then each of its pages
+	   now needs to be recorded individually. */
+	uintptr_t linear = paging_translate_index(pd, 0);
+	struct paging_context *owner = paging_rmap_owner(linear);
+	if (paging_rmap_remove(owner, frame, linear, PAGE_RMAP_LARGE)) {
+		for (uint32_t pt = 0; pt < paging.entries; ++pt) {
+			paging_rmap_insert(
+				owner, frame + ((paddr_t)pt << 12), linear + (pt << 12), 0
+			);
+		}
+	}
+	irq_restore(irq);
+
+	/* The translations are unchanged, but the large page must not remain in
+	   the TLB alongside the new entries. Its page table window entry has also
+	   changed. */
+	paging_tlb_defer(batch, paging_translate_index(pd, 0), 0, 0);
+	paging_tlb_defer(batch, paging_address_for_table(info, pd), 0, 0);
+
+	/* If the block came from the physical memory manager, then each of its
+	   frames needs to be releasable individually from now on. */
+	if (pmm_frame_references(frame) > 0) {
+		pmm_split_frames(frame, paging_large_page_order());
+	}
+
+	return e_ok;
+}
+
+oserr paging_map_large(paging_info_t info, paddr_t frame, uintptr_t linear)
+{
+	if (!paging.large_pages) {
+		klogc(swarn, "Large pages are not supported.\n");
+		return e_fail;
+	}
+
+	if ((frame & LARGE_PAGE_MASK) || (linear & (LARGE_PAGE_SIZE - 1))) {
+		klogc(
+			swarn, "Large page %p (%llx) is not correctly aligned.\n",
+			linear, frame
+		);
+		return e_fail;
+	}
+
+	uint32_t pd, pt;
+	paging_translate_linear(linear, &pd, &pt);
+
+	/* The large page takes the place of an entire page table, so there must
+	   not be one already. */
+	void *dir = (void *)paging_address_for_directory(info);
+	if (paging_entry(dir, pd) & page_present) {
+		klogc(swarn, "Page table %d already exists in directory.\n", pd);
+		return e_fail;
+	}
+
+	paging_set_directory_entry(
+		info, pd, frame | paging_page_flags(linear) | page_large
+	);
+	paging_rmap_insert(
+		paging_rmap_owner(linear), frame, linear, PAGE_RMAP_LARGE
+	);
+	return e_ok;
+}
+
+oserr paging_unmap_large(paging_info_t info, uintptr_t linear)
+{
+	if (!page_is_large(info, linear)) {
+		klogc(swarn, "Page %p is not part of a large page.\n", linear);
+		return e_fail;
+	}
+
+	uint32_t pd, pt;
+	paging_translate_linear(linear, &pd, &pt);
+
+	/* Remove the entry and return the whole block to the physical memory
+	   manager. The entry was also visible through the page table window. */
+	struct paging_tlb_batch batch = { 0 };
+	void *dir = (void *)paging_address_for_directory(info);
+	paddr_t frame = paging_entry_frame(paging_entry(dir, pd));
+	frame &= ~LARGE_PAGE_MASK;
+	paging_set_directory_entry(info, pd, 0);
+	paging_rmap_remove(
+		paging_rmap_owner(linear), frame, linear & ~(LARGE_PAGE_SIZE - 1),
+		PAGE_RMAP_LARGE
+	);
+	paging_tlb_defer(
+		&batch, paging_translate_index(pd, 0), frame,
+		paging_large_page_order()
+	);
+	paging_tlb_defer(&batch, paging_address_for_table(info, pd), 0, 0);
+	paging_tlb_commit(&batch);
 
-	/* Make sure the TLB is flushed if required. */
-	paging_tlb_invalidate(false, linear);
 	return e_ok;
 }
 
@@ -340,46 +1062,504 @@ oserr paging_unmap(paging_info_t info, uintptr_t linear)
 	uint32_t pd, pt;
 	paging_translate_linear(linear, &pd, &pt);
 
+	/* A single page can not be removed from a large page, so the large page
+	   must be broken up into a page table first. */
+	struct paging_tlb_batch batch = { 0 };
+	if (page_is_large(info, linear)
+		&& paging_split_large(info, pd, &batch) != e_ok
+	) {
+		klogc(swarn, "Failed to split large page for %p\n", linear);
+		return e_fail;
+	}
+
 	/* Look up the entry and mark it as not present. Also get the frame and
-	   inform the physical memory manager that it is no longer in use. */
-	struct paging_context *ctx = info;
-	union page *page_table = (void *)paging_address_for_table(info, pd);
+	   inform the physical memory manager that it is no longer in use, once
+	   the page has been invalidated. */
+	void *page_table = (void *)paging_address_for_table(info, pd);
 
-	uintptr_t frame = (page_table[pt].s.frame << 12);
-	page_table[pt].s.present = 0;
-	pmm_release_frame(frame);
+	paddr_t frame = paging_entry_frame(paging_entry(page_table, pt));
+	paging_set_entry(page_table, pt, 0);
+	paging_rmap_remove(paging_rmap_owner(linear), frame, linear, 0);
+	paging_tlb_defer(&batch, linear & ~(PAGE_SIZE - 1), frame, 0);
+	paging_tlb_commit(&batch);
 
 	return e_ok;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-uintptr_t paging_find_linear(paging_info_t info)
+oserr paging_map_range(
+	paging_info_t info, paddr_t frame, uintptr_t linear, uint32_t count
+) {
+	void *dir = (void *)paging_address_for_directory(info);
+
+	uint32_t pd, pt;
+	paging_translate_linear(linear, &pd, &pt);
+
+	/* Fill each page table in turn, only creating a table once it is known
+	   to be needed. */
+	uint32_t i = 0;
+	while (i < count) {
+		uint32_t run = MIN(count - i, paging.entries - pt);
+		uint64_t entry = paging_entry(dir, pd);
+
+		if ((entry & page_present) && (entry & page_large)) {
+			/* Already mapped by a large page. */
+			klogc(swarn, "Page table %d is a large page.\n", pd);
+		}
+		else {
+			if (!(entry & page_present)
+				&& paging_create_table(info, pd) != e_ok
+			) {
+				klogc(swarn, "Failed to create page table %d\n", pd);
+				return e_fail;
+			}
+
+			void *table = (void *)paging_address_for_table(info, pd);
+			for (uint32_t n = 0; n < run; ++n) {
+				if (paging_entry(table, pt + n) & page_present) {
+					continue;
+				}
+
+				paddr_t page = frame + ((paddr_t)(i + n) << 12);
+				uintptr_t address = paging_translate_index(pd, pt + n);
+				paging_set_entry(
+					table, pt + n, 
+					(page & paging.frame_mask) | paging_page_flags(address)
+				);
+				paging_rmap_insert(
+					paging_rmap_owner(address), page & paging.frame_mask,
+					address, 0
+				);
+			}
+		}
+
+		i += run;
+		pd++;
+		pt = 0;
+	}
+
+	return e_ok;
+}
+
+oserr paging_unmap_range(paging_info_t info, uintptr_t linear, uint32_t count)
 {
-	/* Work through the page directory and find the first available page that
-	   is not used. */
-	struct paging_context *ctx = info;
-	union page_table *dir = (void *)paging_address_for_directory(info);
+	struct paging_tlb_batch batch = { 0 };
+	void *dir = (void *)paging_address_for_directory(info);
 
-	for (uint32_t page = 0; page < (1022 * 1024); ++page) {
-		uint32_t pd = page >> 10;
-		uint32_t pt = page & 0x3FF;
+	uint32_t pd, pt;
+	paging_translate_linear(linear, &pd, &pt);
 
-		if (dir[pd].s.present) {
-			union page *table = (void *)paging_address_for_table(info, pd);
-			if (!table[pt].s.present) {
-				return (pd << 22) | (pt << 12);
+	uint32_t i = 0;
+	while (i < count) {
+		uint32_t run = MIN(count - i, paging.entries - pt);
+		uint64_t entry = paging_entry(dir, pd);
+
+		if (!(entry & page_present)) {
+			/* Nothing is mapped by this table. */
+		}
+		else if ((entry & page_large) && run == paging.entries) {
+			/* The whole large page is being released. */
+			paddr_t frame = paging_entry_frame(entry) & ~LARGE_PAGE_MASK;
+			uintptr_t base = paging_translate_index(pd, 0);
+			paging_set_directory_entry(info, pd, 0);
+			paging_rmap_remove(
+				paging_rmap_owner(base), frame, base, PAGE_RMAP_LARGE
+			);
+			paging_tlb_defer(
+				&batch, paging_translate_index(pd, 0), frame,
+				paging_large_page_order()
+			);
+			paging_tlb_defer(
+				&batch, paging_address_for_table(info, pd), 0, 0
+			);
+		}
+		else {
+			/* A large page that is only partly within the range must be
+			   broken up first. */
+			if ((entry & page_large)
+				&& paging_split_large(info, pd, &batch) != e_ok
+			) {
+				klogc(swarn, "Failed to split large page %d\n", pd);
+				paging_tlb_commit(&batch);
+				return e_fail;
 			}
+
+			void *table = (void *)paging_address_for_table(info, pd);
+			for (uint32_t n = 0; n < run; ++n) {
+				entry = paging_entry(table, pt + n);
+				if (entry & page_present) {
+					uintptr_t page = paging_translate_index(pd, pt + n);
+					paddr_t frame = paging_entry_frame(entry);
+					paging_set_entry(table, pt + n, 0);
+					paging_rmap_remove(paging_rmap_owner(page), frame, page, 0);
+					paging_tlb_defer(&batch, page, frame, 0);
+				}
+			}
+		}
+
+		i += run;
+		pd++;
+		pt = 0;
+	}
+
+	paging_tlb_commit(&batch);
+	return e_ok;
+}
+
+uint32_t paging_count_unmapped(
+	paging_info_t info, uintptr_t linear, uint32_t max
+) {
+	void *dir = (void *)paging_address_for_directory(info);
+
+	uint32_t pd, pt;
+	paging_translate_linear(linear, &pd, &pt);
+
+	uint32_t count = 0;
+	while (count < max) {
+		uint32_t run = MIN(max - count, paging.entries - pt);
+		uint64_t entry = paging_entry(dir, pd);
+
+		if (!(entry & page_present)) {
+			count += run;
+		}
+		else if (entry & page_large) {
+			break;
 		}
 		else {
-			return (pd << 22) | (pt << 12);
+			void *table = (void *)paging_address_for_table(info, pd);
+			for (uint32_t n = 0; n < run; ++n, ++count) {
+				if (paging_entry(table, pt + n) & page_present) {
+					return count;
+				}
+			}
+		}
+
+		pd++;
+		pt = 0;
+	}
+
+	return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool paging_copy_on_write(uintptr_t linear)
+{
+	uint32_t pd, pt;
+	paging_translate_linear(linear, &pd, &pt);
+	linear &= ~(PAGE_SIZE - 1);
+
+	void *dir = (void *)paging_address_for_directory(current_paging_ctx);
+	uint64_t entry = paging_entry(dir, pd);
+	if (!(entry & page_present) || (entry & page_large)) {
+		return false;
+	}
+
+	void *table = (void *)paging_address_for_table(current_paging_ctx, pd);
+	entry = paging_entry(table, pt);
+	if (!(entry & page_present) || !(entry & page_cow)) {
+		return false;
+	}
+
+	/* The last context to write to the page can simply take it over. Any
+	   other context needs its own copy. */
+	paddr_t frame = paging_entry_frame(entry);
+	uint64_t flags = (entry & ~(paging.frame_mask | page_cow)) | page_write;
+	if (pmm_frame_references(frame) > 1) {
+		paddr_t copy = pmm_acquire_colored_frame(linear / PAGE_SIZE);
+		void *page = (void *)paging_map_temporary(paging_slot_copy, copy);
+		memcpy(page, (void *)linear, PAGE_SIZE);
+		paging_unmap_temporary(paging_slot_copy);
+
+		paging_set_entry(table, pt, copy | flags);
+		paging_tlb_invalidate(linear);
+		paging_rmap_remove(current_paging_ctx, frame, linear, 0);
+		paging_rmap_insert(current_paging_ctx, copy, linear, 0);
+		pmm_release_frame(frame);
+	}
+	else {
+		paging_set_entry(table, pt, frame | flags);
+		paging_tlb_invalidate(linear);
+	}
+
+	return true;
+}
+
+static uint64_t paging_clone_table(
+	paging_info_t info, struct paging_context *clone, uint32_t pd,
+	uint64_t dir_entry
+) {
+	paddr_t table_frame = pmm_acquire_colored_frame(PMM_COLOR_DIVERSE);
+	pmm_set_frame_purpose(table_frame, frame_paging);
+
+	/* Both contexts lose write access to every page, which is restored by the
+	   first write to it in either context. Each page gains a reference for
+	   the new context. */
+	void *source = (void *)paging_address_for_table(info, pd);
+	void *table = (void *)paging_map_temporary(paging_slot_table, table_frame);
+	for (uint32_t pt = 0; pt < paging.entries; ++pt) {
+		uint64_t entry = paging_entry(source, pt);
+		if (entry & page_present) {
+			if (entry & page_write) {
+				entry = (entry & ~page_write) | page_cow;
+				paging_set_entry(source, pt, entry);
+			}
+
+			/* Pinned frames, such as the zero page, are never released so
+			   their references are not counted. */
+			paddr_t frame = paging_entry_frame(entry);
+			if (!(pmm_frame_flags(frame) & frame_pinned)) {
+				pmm_retain_frame(frame);
+			}
+			paging_rmap_insert(
+				clone, frame, paging_translate_index(pd, pt), 0
+			);
+		}
+		paging_set_entry(table, pt, entry);
+	}
+	paging_unmap_temporary(paging_slot_table);
+
+	return table_frame | (dir_entry & ~paging.frame_mask);
+}
+
+paging_info_t paging_clone_context(paging_info_t info)
+{
+	if (info != current_paging_ctx) {
+		klogc(swarn, "Only the current paging context can be cloned.\n");
+		return NULL;
+	}
+
+	uintptr_t flags = irq_save();
+	struct paging_context *ctx = NULL;
+	uint64_t *pointers = NULL;
+	for (uint32_t i = 0; i < PAGING_MAX_CONTEXTS; ++i) {
+		if (paging_clones[i].ctx.page_dir_physical == 0) {
+			ctx = &paging_clones[i].ctx;
+			pointers = paging_clones[i].page_dir_pointers;
+			break;
+		}
+	}
+	if (!ctx) {
+		irq_restore(flags);
+		klogc(swarn, "Too many paging contexts.\n");
+		return NULL;
+	}
+
+	/* Large pages in the private region are broken up first, so that each of
+	   their pages can be copied individually. */
+	struct paging_tlb_batch batch = { 0 };
+	void *dir = (void *)paging_address_for_directory(info);
+	uint32_t first = PAGE_KERNEL_LIMIT >> paging.shift;
+	uint32_t last = PAGE_FRAME_TABLE >> paging.shift;
+	for (uint32_t pd = first; pd < last; ++pd) {
+		uint64_t entry = paging_entry(dir, pd);
+		if ((entry & page_present) && (entry & page_large)) {
+			paging_split_large(info, pd, &batch);
+		}
+	}
+	paging_tlb_commit(&batch);
+
+	/* Build the new directory. Shared tables are referenced as they are, and
+	   the page table window refers to the new directory. */
+	uint32_t order = paging.pae ? 2 : 0;
+	paddr_t dir_frame = pmm_acquire_frames(order, 0);
+	uint32_t window = PAGE_TABLE_WINDOW >> paging.shift;
+	for (uint32_t i = 0; i < (1U << order); ++i) {
+		paddr_t frame = dir_frame + (i * PAGE_SIZE);
+		pmm_set_frame_purpose(frame, frame_paging);
+		pointers[i] = frame | page_present;
+
+		void *copy = (void *)paging_map_temporary(paging_slot_directory, frame);
+		for (uint32_t n = 0; n < paging.entries; ++n) {
+			uint32_t pd = (i * paging.entries) + n;
+			uint64_t entry = paging_entry(dir, pd);
+
+			if (paging_is_window_table(pd)) {
+				entry = (dir_frame + ((pd - window) * PAGE_SIZE))
+					| page_present | page_write;
+			}
+			else if (!paging_is_shared_table(pd) && (entry & page_present)) {
+				entry = paging_clone_table(info, ctx, pd, entry);
+			}
+			paging_set_entry(copy, n, entry);
+		}
+		paging_unmap_temporary(paging_slot_directory);
+	}
+
+	ctx->page_dir = current_paging_ctx->page_dir;
+	ctx->page_dir_physical = dir_frame;
+	ctx->page_dir_pointers = (uintptr_t)pointers;
+
+	/* Write access has been removed from pages of the current context. */
+	paging_flush();
+	irq_restore(flags);
+
+	return ctx;
+}
+
+static void paging_release_table(
+	struct paging_context *ctx, uint32_t pd, uint64_t dir_entry
+) {
+	paddr_t frame = paging_entry_frame(dir_entry);
+	if (dir_entry & page_large) {
+		frame &= ~LARGE_PAGE_MASK;
+		paging_rmap_remove(
+			ctx, frame, paging_translate_index(pd, 0), PAGE_RMAP_LARGE
+		);
+		pmm_release_frames(frame, paging_large_page_order());
+		return;
+	}
+
+	/* Pinned frames had no reference taken for the context. */
+	void *table = (void *)paging_map_temporary(paging_slot_table, frame);
+	for (uint32_t pt = 0; pt < paging.entries; ++pt) {
+		uint64_t entry = paging_entry(table, pt);
+		if (entry & page_present) {
+			paddr_t page = paging_entry_frame(entry);
+			paging_rmap_remove(ctx, page, paging_translate_index(pd, pt), 0);
+			if (!(pmm_frame_flags(page) & frame_pinned)) {
+				pmm_release_frame(page);
+			}
 		}
 	}
-	return 0;
+	paging_unmap_temporary(paging_slot_table);
+	pmm_release_frame(frame);
+}
+
+oserr paging_release_context(paging_info_t info)
+{
+	struct paging_context *ctx = info;
+	if (ctx == current_paging_ctx || ctx == kernel_paging_ctx
+		|| ctx->page_dir_physical == 0
+	) {
+		klogc(swarn, "Paging context %p can not be released.\n", info);
+		return e_fail;
+	}
+
+	/* Tables that are shared by every context are left alone. The context is
+	   not in use, so none of its translations can be cached. */
+	uintptr_t flags = irq_save();
+	uint32_t order = paging.pae ? 2 : 0;
+	paddr_t dir_frame = ctx->page_dir_physical;
+	for (uint32_t i = 0; i < (1U << order); ++i) {
+		paddr_t frame = dir_frame + (i * PAGE_SIZE);
+		void *dir = (void *)paging_map_temporary(paging_slot_directory, frame);
+		for (uint32_t n = 0; n < paging.entries; ++n) {
+			uint32_t pd = (i * paging.entries) + n;
+			uint64_t entry = paging_entry(dir, n);
+			if ((entry & page_present) && !paging_is_shared_table(pd)
+				&& !paging_is_window_table(pd)
+			) {
+				paging_release_table(ctx, pd, entry);
+			}
+		}
+		paging_unmap_temporary(paging_slot_directory);
+	}
+
+	pmm_release_frames(dir_frame, order);
+	ctx->page_dir_physical = 0;
+	irq_restore(flags);
+
+	return e_ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uintptr_t paging_map_temporary(enum paging_slot slot, paddr_t frame)
+{
+	/* Before paging is enabled, physical memory can be accessed directly. */
+	if (!paging_is_enabled()) {
+		return (uintptr_t)frame;
+	}
+
+	/* The temporary slots occupy the start of a page table that is created
+	   when paging is initialised, so the entry can be written directly. */
+	uintptr_t linear = paging_translate_index(PAGE_TEMP_TABLE, slot);
+	void *table = (void *)paging_address_for_table(
+		kernel_paging_ctx, PAGE_TEMP_TABLE
+	);
+
+	paging_set_entry(table, slot, frame | page_present | page_write);
+	return linear;
+}
+
+void paging_unmap_temporary(enum paging_slot slot)
+{
+	if (!paging_is_enabled()) {
+		return;
+	}
+
+	uintptr_t linear = paging_translate_index(PAGE_TEMP_TABLE, slot);
+	void *table = (void *)paging_address_for_table(
+		kernel_paging_ctx, PAGE_TEMP_TABLE
+	);
+
+	paging_set_entry(table, slot, 0);
+	paging_tlb_invalidate(linear);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+void paging_set_fault_handler(paging_fault_handler_t handler)
+{
+	fault_handler = handler;
+}
+
+void paging_window_range(uintptr_t *start, uintptr_t *end)
+{
+	*start = PAGE_TABLE_WINDOW;
+	*end = PAGE_TABLE_WINDOW + (paging.tables * PAGE_SIZE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool paging_wants_pae(void)
+{
+	/* PAE doubles the size of every paging structure, so it is only worth
+	   using when there is memory beyond 4GiB that would otherwise be unused.
+	   Replacing an entry also requires the CMPXCHG8B instruction. */
+	uint32_t required = i386_pae | i386_cx8;
+	if ((master_cpu.cpuid_features_lo & required) != required) {
+		return false;
+	}
+
+#if defined(PAGING_FORCE_PAE)
+	return true;
+#else
+	return pmm_has_high_memory();
+#endif
+}
+
+static paddr_t paging_create_directory(void)
+{
+	/* Create the page directory. In PAE mode this is four directories in
+	   consecutive frames, so that they can be indexed as one. */
+	uint32_t order = paging.pae ? 2 : 0;
+	paddr_t dir = pmm_acquire_frames(order, 0);
+	for (uint32_t i = 0; i < (1U << order); ++i) {
+		pmm_set_frame_purpose(dir + (i * PAGE_SIZE), frame_paging);
+	}
+	memset((void *)(uintptr_t)dir, 0, PAGE_SIZE << order);
+
+	/* Map each directory into the page table window, which makes every page
+	   table of the context accessible once paging is enabled. */
+	uint32_t window = PAGE_TABLE_WINDOW >> paging.shift;
+	for (uint32_t i = 0; i < (1U << order); ++i) {
+		paddr_t frame = dir + (i * PAGE_SIZE);
+		paging_set_entry(
+			(void *)(uintptr_t)dir, window + i, 
+			frame | page_present | page_write
+		);
+
+		if (paging.pae) {
+			kernel_page_dir_pointers[i] = frame | page_present;
+		}
+	}
+
+	return dir;
+}
+
 oserr init_paging(void)
 {
 	/* Should we proceed? If paging is not supported, or already enabled then
@@ -396,28 +1576,88 @@ oserr init_paging(void)
 		return e_ok;
 	}
 
+	/* Choose between 32-bit paging and PAE. */
+	if (paging_wants_pae()) {
+		paging.pae = true;
+		paging.shift = 21;
+		paging.entries = 512;
+		paging.tables = 2048;
+		paging.frame_mask = PAE_FRAME_MASK;
+		klogc(sinfo, "Using PAE paging.\n");
+	}
+
+	/* Large pages greatly reduce the number of TLB entries that are needed to
+	   cover the kernel, so use them if they are available. They are always
+	   available with PAE. */
+	if (paging.pae || (master_cpu.cpuid_features_lo & i386_pse)) {
+		paging.large_pages = true;
+		klogc(sinfo, "Using %dKiB pages where possible.\n", 
+			LARGE_PAGE_SIZE >> 10
+		);
+	}
+
+	/* Kernel translations can be kept in the TLB across a change of context
+	   if global pages are supported. */
+	if (master_cpu.cpuid_features_lo & i386_pge) {
+		paging.global_pages = true;
+		klogc(sinfo, "Using global pages for the kernel.\n");
+	}
+
 	/* Acquire any required memory for the kernel paging context to work 
 	   correctly. */
-	__kernel_paging_ctx.page_dir_physical = pmm_acquire_frame();
-	__kernel_paging_ctx.page_dir = (void *)(
-		(PAGE_TABLE_TABLE << 22) | (PAGE_TABLE_TABLE << 12)
+	__kernel_paging_ctx.page_dir_physical = paging_create_directory();
+	__kernel_paging_ctx.page_dir_pointers = (uintptr_t)kernel_page_dir_pointers;
+	__kernel_paging_ctx.page_dir = (void *)paging_translate_index(
+		PAGE_TABLE_WINDOW >> paging.shift, PAGE_TABLE_WINDOW >> paging.shift
 	);
 
-	/* Create the initial page tables */
-	paging_create_table(kernel_paging_ctx, PAGE_TABLE_TABLE);
-	paging_create_table(kernel_paging_ctx, PAGE_DIR_TABLE);
+	/* Create the table that hosts the temporary mapping slots. */
+	paging_create_table(kernel_paging_ctx, PAGE_TEMP_TABLE);
 
 	/* Perform any initial identity mapping that is required for the Kernel to
-	   operate correctly once paging is enabled. */
-	idmap(kernel_paging_ctx, frame_bios);
-	idmap(kernel_paging_ctx, frame_kernel_wired);
+	   operate correctly once paging is enabled. The frame table is excluded
+	   as it can be far larger than the identity mapped region. */
+	uintptr_t start, end, table_start, table_end;
+	pmm_table_range(&table_start, &table_end);
+	pmm_frame_range(frame_bios, &start, &end);
+	idmap(kernel_paging_ctx, start, end);
+	pmm_frame_range(frame_kernel_wired, &start, &end);
+	idmap(kernel_paging_ctx, start, table_start);
+
+	/* Map the frame table into its own region. */
+	paging_map_range(
+		kernel_paging_ctx, table_start, PAGE_FRAME_TABLE, 
+		(table_end - table_start) / PAGE_SIZE
+	);
 
 	/* Install an interrupt handler for the page fault exception. */
 	set_int_handler(0x0E, page_fault_handler);
 
-	/* Enable paging */
+	/* Enable paging. The frame table must be relocated before anything else
+	   is able to use the physical memory manager. */
+	uintptr_t flags = irq_save();
+	if (paging.pae) {
+		set_cr4(get_cr4() | CR4_PAE);
+	}
+	else if (paging.large_pages) {
+		set_cr4(get_cr4() | CR4_PSE);
+	}
 	paging_set_context(kernel_paging_ctx);
 	paging_set_enabled(true);
+	set_cr0(get_cr0() | CR0_WP);
+	if (paging.global_pages) {
+		set_cr4(get_cr4() | CR4_PGE);
+	}
+	pmm_relocate_table(PAGE_FRAME_TABLE);
+	irq_restore(flags);
+
+	/* Every mapping made from now on is recorded in the reverse map. */
+	rmap.ready = true;
+
+	/* Memory beyond 4GiB can now be addressed. */
+	if (paging.pae && pmm_has_high_memory()) {
+		pmm_enable_high_memory();
+	}
 
 	return e_ok;
 }
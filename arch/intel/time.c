@@ -30,4 +30,9 @@ uint64_t uptime_ms(void)
 	return pit_total_ms();
 }
 
+uint64_t cpu_ticks(void)
+{
+	return rdtsc();
+}
+
 #endif
\ No newline at end of file
@@ -25,11 +25,88 @@
 
 #include <types.h>
 
+/* Allocations of up to 2^(KALLOC_MIN_SHIFT + KALLOC_CLASSES - 1) bytes are
+   rounded up to a power of two size class, and each thread keeps a magazine
+   of recently freed allocations for every class. */
+#define KALLOC_CLASSES			6
+#define KALLOC_MIN_SHIFT		4
+#define KALLOC_MAGAZINE_SIZE	16
+
+/* Allocations of at least KALLOC_LARGE_SIZE bytes are not made on the heap.
+   Each is given a run of whole pages of its own, which are all returned as
+   soon as it is freed. The pages come from the window between VMALLOC_BASE
+   and VMALLOC_LIMIT, so no more than 256MiB of such allocations can be held
+   at once. */
+#define KALLOC_LARGE_SIZE		0x1000
+
+/**
+ A stack of free allocations of a single size class.
+ */
+struct kalloc_magazine
+{
+	uint32_t count;
+	void *objects[KALLOC_MAGAZINE_SIZE];
+};
+
+/**
+ The allocations cached by a thread. Every allocation in the magazines belongs
+ to _heap_, and is returned to it if the thread starts to use another heap.
+ */
+struct kalloc_cache
+{
+	void *heap;
+	struct kalloc_magazine magazines[KALLOC_CLASSES];
+};
+
+/**
+ Prepare an empty allocation cache.
+ */
+void kalloc_init_cache(struct kalloc_cache *cache);
+
+/**
+ Return every allocation in the cache to the heap that it belongs to.
+ */
+void kalloc_flush_cache(struct kalloc_cache *cache);
+
 /**
  Allocate memory within the current context of the specified size.
  */
 void *kalloc(uint32_t size);
 
+/**
+ Allocate memory within the current context of the specified size, aligned to
+ a multiple of _align_ bytes.
+ */
+void *kalloc_aligned(uint32_t size, uint32_t align);
+
+/**
+ Allocate memory of the specified size from the emergency reserve, without
+ waiting and without using the heap. This is safe to use from an interrupt
+ handler, and returns NULL rather than waiting for memory to become available.
+ The memory is freed with kfree() from a thread once it is no longer needed.
+ */
+void *kalloc_atomic(uint32_t size);
+
+/**
+ Allocate memory within the current context, in the same way as kalloc(), but
+ without recording the allocation in the heap profile or allocation trace. This
+ is only for filling the emergency reserve, whose allocations are recorded by
+ kalloc_atomic() when they are handed out.
+ */
+void *__kalloc_unrecorded(uint32_t size);
+
+/**
+ Allocate cleared memory within the current context for _count_ objects of the
+ specified size.
+ */
+void *kcalloc(uint32_t count, uint32_t size);
+
+/**
+ Resize memory within the current context for the specified location. It is
+ grown in place when possible.
+ */
+void *krealloc(void *ptr, uint32_t size);
+
 /**
  Free memory within the current context for the specified location.
  */
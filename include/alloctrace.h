@@ -0,0 +1,88 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#if !defined(ALLOCTRACE_H)
+#define ALLOCTRACE_H
+
+#include <types.h>
+
+/* The allocation trace recorder is only built when ALLOC_TRACE is defined.
+   Otherwise the hooks below expand to nothing and have no cost at all. */
+
+/* Every record on the serial line begins with this byte. It can never appear
+   in the text that is logged alongside the trace, so a reader can always find
+   the start of the next record. */
+#define ALLOC_TRACE_MARKER		0xA7
+
+/**
+ The kinds of record in an allocation trace. Each record is the marker, the
+ event byte and then the listed 32-bit fields in little endian order.
+ 	- alloc_trace_alloc		size, ptr
+ 	- alloc_trace_calloc	size, ptr
+ 	- alloc_trace_aligned	size, align, ptr
+ 	- alloc_trace_realloc	old, size, ptr
+ 	- alloc_trace_free		ptr
+ Failed allocations are not recorded. A realloc to a size of 0 has a ptr of 0
+ and frees the old allocation.
+ */
+enum alloc_trace_event
+{
+	alloc_trace_alloc = 'A',
+	alloc_trace_calloc = 'C',
+	alloc_trace_aligned = 'L',
+	alloc_trace_realloc = 'R',
+	alloc_trace_free = 'F',
+};
+
+/**
+ The number of 32-bit fields that follow a record of the specified kind, or 0
+ if it is not a known kind of record.
+ */
+static inline uint32_t alloc_trace_fields(uint8_t event)
+{
+	switch (event) {
+		case alloc_trace_alloc:
+		case alloc_trace_calloc:
+			return 2;
+		case alloc_trace_aligned:
+		case alloc_trace_realloc:
+			return 3;
+		case alloc_trace_free:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+extern void __alloc_trace(
+	enum alloc_trace_event event, uint32_t a, uint32_t b, uint32_t c
+);
+
+#if defined(ALLOC_TRACE)
+#	define alloc_trace(_event, _a, _b, _c)	\
+		(__alloc_trace((_event), (uint32_t)(_a), (uint32_t)(_b),	\
+			(uint32_t)(_c)))
+#else
+#	define alloc_trace(_event, _a, _b, _c)
+#endif
+
+#endif
\ No newline at end of file
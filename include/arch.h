@@ -50,4 +50,17 @@ void hang(void);
  */
 void init_arch(void);
 
+/**
+ The number of page colors of the largest cache that the CPU reports, being the
+ number of pages that fit in a single way of the cache. Returns 1 if this is
+ not known.
+ */
+uint32_t arch_cache_colors(void);
+
+/**
+ The number of ways of the cache that arch_cache_colors() describes, so that it
+ can hold this many pages of each color. Returns 1 if this is not known.
+ */
+uint32_t arch_cache_ways(void);
+
 #endif
\ No newline at end of file
@@ -32,6 +32,15 @@ static inline void cpuid(uint32_t s, uint32_t *d)
 	);
 }
 
+static inline void cpuid_count(uint32_t s, uint32_t sub, uint32_t *d)
+{
+	__asm__ volatile(
+		"cpuid" 
+		: "=a"(d[0]), "=b"(d[1]), "=c"(d[2]), "=d"(d[3])
+		: "a"(s), "b"(0), "c"(sub), "d"(0)
+	);
+}
+
 enum i386_feature
 {
 	/* Low Feature Bits */
@@ -39,6 +39,8 @@ struct i386_cpu
 	char brand[48];
 	enum i386_feature cpuid_features_lo;
 	enum i386_feature cpuid_features_hi;
+	uint32_t cache_colors;
+	uint32_t cache_ways;
 };
 
 extern struct i386_cpu master_cpu;
@@ -25,44 +25,35 @@
 
 #define PAGE_SIZE 0x1000
 
+/**
+ A paging context. The page directory is accessed through the recursive mapping
+ once paging is enabled. When physical address extensions are in use, the page
+ directory is made up of four consecutive frames that are referenced by the
+ page directory pointer table.
+ */
 struct paging_context 
 {
-	union page_table *page_dir;
-	uintptr_t page_dir_physical;
+	void *page_dir;
+	paddr_t page_dir_physical;
+	uintptr_t page_dir_pointers;
 } __attribute__((packed));
 
-union page 
-{
-	struct {
-		uint32_t present:1;
-		uint32_t write:1;
-		uint32_t user:1;
-		uint32_t write_through:1;
-		uint32_t cache_disable:1;
-		uint32_t accessed:1;
-		uint32_t dirty:1;
-		uint32_t pat:1;
-		uint32_t ignored:4;
-		uint32_t frame:20;
-	} __attribute__((packed)) s;
-	uint32_t i;
-};
-
-union page_table 
+/**
+ Flags of a page table or page directory entry. These are shared by both the
+ 32-bit and PAE paging modes, which only differ in the width of the entries.
+ */
+enum page_flag
 {
-	struct {
-		uint32_t present:1;
-		uint32_t write:1;
-		uint32_t user:1;
-		uint32_t write_through:1;
-		uint32_t cache_disable:1;
-		uint32_t accessed:1;
-		uint32_t ignored1:1;
-		uint32_t large:1;
-		uint32_t ignored2:4;
-		uint32_t frame:20;
-	} __attribute__((packed)) s;
-	uint32_t i;
+	page_present = (1 << 0),
+	page_write = (1 << 1),
+	page_user = (1 << 2),
+	page_write_through = (1 << 3),
+	page_cache_disable = (1 << 4),
+	page_accessed = (1 << 5),
+	page_dirty = (1 << 6),
+	page_large = (1 << 7),
+	page_global = (1 << 8),
+	page_cow = (1 << 9),		/* Available to software. Copy on write. */
 };
 
 extern struct paging_context kernel_pd;
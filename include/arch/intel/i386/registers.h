@@ -54,5 +54,17 @@ static inline void set_cr3(uintptr_t cr3)
 	__asm__ volatile("mov %0, %%cr3" :: "r"(cr3));
 }
 
+static inline uint32_t get_cr4(void)
+{
+	uint32_t cr4;
+	__asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+	return cr4;
+}
+
+static inline void set_cr4(uint32_t cr4)
+{
+	__asm__ volatile("mov %0, %%cr4" :: "r"(cr4));
+}
+
 
 #endif
\ No newline at end of file
@@ -43,4 +43,31 @@ static inline void sti(void)
 	__asm__ volatile("sti");
 }
 
+static inline void cpu_relax(void)
+{
+	__asm__ volatile("pause" ::: "memory");
+}
+
+static inline uintptr_t irq_save(void)
+{
+	uintptr_t flags;
+	__asm__ volatile("pushf\n\tpop %0\n\tcli" : "=r"(flags) :: "memory");
+	return flags;
+}
+
+static inline void irq_restore(uintptr_t flags)
+{
+	/* Only re-enable interrupts if they were enabled when saved. */
+	if (flags & (1 << 9)) {
+		sti();
+	}
+}
+
+static inline uint64_t rdtsc(void)
+{
+	uint32_t lo, hi;
+	__asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,44 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#if !defined(COLORBENCH_H)
+#define COLORBENCH_H
+
+#include <types.h>
+
+/* Working sets are limited to COLORBENCH_MAX_PAGES pages, and are walked
+   COLORBENCH_PASSES times unless asked otherwise. */
+#define COLORBENCH_MAX_PAGES	1024
+#define COLORBENCH_PASSES		16
+
+/**
+ Measure the effect of frame coloring on cache conflicts. Working sets of
+ _pages_ pages are built from a physically contiguous run of frames, from
+ frames scattered at random, from frames of every color in turn, and from
+ frames that all share a single color. Each set is then read one cache line at
+ a time for _passes_ passes, and the fastest pass is reported. A _pages_ of 0
+ fills 7/8 of the cache, and a _passes_ of 0 selects COLORBENCH_PASSES.
+ Coloring is enabled for the duration of the benchmark.
+ */
+void colorbench_run(uint32_t pages, uint32_t passes);
+
+#endif
\ No newline at end of file
@@ -24,10 +24,22 @@
 #define HEAP_H
 
 #include <types.h>
+#include <lock.h>
 
 struct heap;
 struct heap_block;
 
+/**
+ Number of free list size classes. A free block is placed in the class given by
+ the position of the highest set bit of its size.
+ */
+#define HEAP_FREE_CLASSES	32
+
+/* Pages of free blocks are kept mapped until more than the high watermark are
+   held, at which point they are trimmed back down to the low watermark. */
+#define HEAP_RETAIN_LOW		64
+#define HEAP_RETAIN_HIGH	256
+
 /**
  Possible states that a heap block can be in.
  */
@@ -39,7 +51,9 @@ enum heap_state
 
 /**
  Block header structure. Contains information about a block of memory on the 
- heap.
+ heap. Blocks are linked in address order in both directions, so the headers
+ act as boundary tags and either neighbour of a block is found in constant
+ time when it is coalesced.
  */
 struct heap_block
 {
@@ -51,8 +65,26 @@ struct heap_block
 	struct heap_block *back;
 } __attribute__((packed));
 
+/**
+ Free list links. These are stored at the start of a free block's data, so
+ that the block header itself is unchanged by being placed in a free list.
+ */
+struct heap_links
+{
+	struct heap_block *next;
+	struct heap_block *back;
+};
+
 /**
  Heap structure. Contains information about the entire heap.
+ 	- free_map		Bit n is set when free_lists[n] is not empty.
+ 	- free_lists	The free blocks, segregated by power of two size class.
+ 	- retained		An estimate of the mapped pages held by free blocks.
+ 	- retain_low	The number of pages that a trim leaves retained.
+ 	- retain_high	The number of retained pages that causes a trim.
+ 	- trims			The number of times that the heap has been trimmed.
+ 	- trimmed		The number of pages released by trimming.
+ 	- lock			Held by every operation on the heap.
  */
 struct heap 
 {
@@ -62,6 +94,14 @@ struct heap
 	uint32_t free_blocks;
 	struct heap_block *first;
 	struct heap_block *last;
+	uint32_t free_map;
+	struct heap_block *free_lists[HEAP_FREE_CLASSES];
+	uint32_t retained;
+	uint32_t retain_low;
+	uint32_t retain_high;
+	uint32_t trims;
+	uint32_t trimmed;
+	struct spinlock lock;
 };
 
 /**
@@ -75,6 +115,35 @@ oserr init_heap(struct heap **heap, uintptr_t base, uintptr_t limit);
  */
 void *heap_alloc(struct heap *heap, uint32_t size);
 
+/**
+ Make up to _count_ allocations of the same size on the heap, whilst only
+ acquiring the heap's lock once. The allocations are placed in _objects_ and
+ the number that could be made is returned.
+ */
+uint32_t heap_alloc_batch(
+	struct heap *heap, uint32_t size, void **objects, uint32_t count
+);
+
+/**
+ Make an allocation on the heap whose address is a multiple of _align_, which
+ must be a power of two.
+ */
+void *heap_alloc_aligned(struct heap *heap, uint32_t size, uint32_t align);
+
+/**
+ Make an allocation on the heap for _count_ objects of _size_ bytes, with all
+ of the memory cleared to zero.
+ */
+void *heap_calloc(struct heap *heap, uint32_t count, uint32_t size);
+
+/**
+ Change the size of an allocation on the heap. The allocation is grown in place
+ if the block following it is free and large enough, otherwise it is moved to a
+ new block and the original is removed. The contents are preserved up to the
+ smaller of the two sizes. The alignment of a moved allocation is not kept.
+ */
+void *heap_realloc(struct heap *heap, void *ptr, uint32_t size);
+
 /**
  Remove an allocation on the heap. Release the memory that is associated with 
  the allocation, and collects it into "neighbouring blocks" to form a single
@@ -82,4 +151,35 @@ void *heap_alloc(struct heap *heap, uint32_t size);
  */
 void heap_dealloc(struct heap *heap, void *ptr);
 
+/**
+ Remove _count_ allocations from the heap, whilst only acquiring the heap's lock
+ once.
+ */
+void heap_dealloc_batch(struct heap *heap, void **objects, uint32_t count);
+
+/**
+ Get the number of bytes that can be used in the allocation, which may be more
+ than were requested. Returns 0 if the pointer is not an allocation of the heap.
+ */
+uint32_t heap_alloc_size(struct heap *heap, void *ptr);
+
+/**
+ Release the pages held by free blocks of the heap, until no more than _target_
+ pages are retained.
+ */
+void heap_trim(struct heap *heap, uint32_t target);
+
+/**
+ Release up to _count_ of the pages held by free blocks of the heap, without
+ waiting for the heap's lock. Returns the number of pages released, which is 0
+ if the lock is already held.
+ */
+uint32_t heap_shrink(struct heap *heap, uint32_t count);
+
+/**
+ Set the watermarks of the heap's page retention. Once more than _high_ pages
+ of free blocks are held, they are trimmed back down to _low_ pages.
+ */
+oserr heap_set_retention(struct heap *heap, uint32_t low, uint32_t high);
+
 #endif
\ No newline at end of file
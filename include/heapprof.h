@@ -0,0 +1,80 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#if !defined(HEAPPROF_H)
+#define HEAPPROF_H
+
+#include <types.h>
+
+/* The heap profiler is only built when HEAP_PROFILE is defined. Otherwise the
+   hooks below expand to nothing and have no cost at all. */
+
+/* Allocations are counted against up to HEAPPROF_MAX_SITES call sites, and up
+   to HEAPPROF_MAX_TRACKED live allocations are remembered so that their frees
+   can be attributed. */
+#define HEAPPROF_MAX_SITES		128
+#define HEAPPROF_MAX_TRACKED	8192
+
+/* Bucket n of a size histogram counts allocations of at least 2^(n + 3) and
+   less than 2^(n + 4) bytes. The first and last buckets also count everything
+   smaller and larger respectively. */
+#define HEAPPROF_BUCKETS		13
+#define HEAPPROF_MIN_SHIFT		4
+
+/**
+ The allocations made from a single call site.
+ 	- site			The address that the allocation call returns to.
+ 	- allocs		The number of allocations made.
+ 	- frees			The number of those allocations that have been freed.
+ 	- live_bytes	The number of bytes that are currently allocated.
+ 	- peak_bytes	The largest value that live_bytes has reached.
+ 	- histogram		The number of allocations made in each size bucket.
+ */
+struct heapprof_site
+{
+	uintptr_t site;
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t live_bytes;
+	uint32_t peak_bytes;
+	uint32_t histogram[HEAPPROF_BUCKETS];
+};
+
+extern void __heapprof_alloc(uintptr_t site, void *ptr, uint32_t size);
+extern void __heapprof_free(void *ptr);
+extern void __heapprof_report(void);
+extern void __heapprof_dump(void);
+
+#if defined(HEAP_PROFILE)
+#	define heapprof_alloc(_site, _ptr, _size)	\
+		(__heapprof_alloc((_site), (_ptr), (_size)))
+#	define heapprof_free(_ptr)		(__heapprof_free((_ptr)))
+#	define heapprof_report()		(__heapprof_report())
+#	define heapprof_dump()			(__heapprof_dump())
+#else
+#	define heapprof_alloc(_site, _ptr, _size)
+#	define heapprof_free(_ptr)
+#	define heapprof_report()
+#	define heapprof_dump()
+#endif
+
+#endif
\ No newline at end of file
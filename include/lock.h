@@ -0,0 +1,88 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#if !defined(LOCK_H)
+#define LOCK_H
+
+#include <types.h>
+#include <arch.h>
+
+/**
+ A lock that is held with interrupts disabled, so that the holder can not be
+ preempted by another thread that then waits on the same lock. The lock word
+ itself is only contended once there is more than one processor.
+ 	- locked	Non-zero whilst the lock is held.
+ 	- flags		The interrupt state from before the lock was acquired.
+ */
+struct spinlock
+{
+	volatile uint32_t locked;
+	uintptr_t flags;
+};
+
+/**
+ Initialise the lock so that it is not held.
+ */
+static inline void spin_init(struct spinlock *lock)
+{
+	lock->locked = 0;
+	lock->flags = 0;
+}
+
+/**
+ Acquire the lock, waiting for it to be released if it is already held.
+ */
+static inline void spin_lock(struct spinlock *lock)
+{
+	uintptr_t flags = irq_save();
+	while (__sync_lock_test_and_set(&lock->locked, 1)) {
+		cpu_relax();
+	}
+	lock->flags = flags;
+}
+
+/**
+ Acquire the lock only if it is not already held, without waiting for it.
+ Returns true if the lock was acquired.
+ */
+static inline bool spin_trylock(struct spinlock *lock)
+{
+	uintptr_t flags = irq_save();
+	if (__sync_lock_test_and_set(&lock->locked, 1)) {
+		irq_restore(flags);
+		return false;
+	}
+	lock->flags = flags;
+	return true;
+}
+
+/**
+ Release the lock, restoring the interrupt state of its holder.
+ */
+static inline void spin_unlock(struct spinlock *lock)
+{
+	uintptr_t flags = lock->flags;
+	__sync_lock_release(&lock->locked);
+	irq_restore(flags);
+}
+
+#endif
\ No newline at end of file
@@ -33,6 +33,47 @@
 typedef void * paging_info_t;
 extern paging_info_t kernel_paging_ctx;
 
+/**
+ Statistics about the invalidation of TLB entries.
+ 	- invalidations	Individual pages that have been invalidated.
+ 	- full_flushes	Times the entire TLB has been flushed.
+ 	- global_flushes	Full flushes that also removed global pages.
+ 	- batches		Batches of deferred invalidations that were completed.
+ 	- deferred		Invalidations that have been added to a batch.
+ */
+struct paging_tlb_stats
+{
+	uint32_t invalidations;
+	uint32_t full_flushes;
+	uint32_t global_flushes;
+	uint32_t batches;
+	uint32_t deferred;
+};
+
+/**
+ A mapping of a physical frame at a linear address of a paging context.
+ */
+struct paging_mapping
+{
+	paging_info_t info;
+	uintptr_t linear;
+};
+
+/**
+ Slots in the linear address space that are reserved for temporary mappings of
+ physical frames. Each slot should only be used by a single owner.
+ */
+enum paging_slot
+{
+	paging_slot_zero,
+	paging_slot_split,
+	paging_slot_directory,
+	paging_slot_table,
+	paging_slot_copy,
+	paging_slot_shared,
+	paging_slot_count
+};
+
 /**
  Check if the system supports a paging environment.
  */
@@ -49,6 +90,29 @@ bool paging_is_enabled(void);
  */
 bool page_is_mapped(paging_info_t info, uintptr_t linear);
 
+/**
+ Check if the specified address is mapped by a large page within the specified
+ paging context.
+ */
+bool page_is_large(paging_info_t info, uintptr_t linear);
+
+/**
+ Check if large pages are available for use in paging contexts.
+ */
+bool paging_has_large_pages(void);
+
+/**
+ The number of frames that make up a large page, as a power of 2. This depends
+ upon the paging mode that was chosen when paging was initialised.
+ */
+uint32_t paging_large_page_order(void);
+
+/**
+ Check if a large page could be mapped at the specified linear address without
+ disturbing any existing mappings.
+ */
+bool paging_large_page_available(paging_info_t info, uintptr_t linear);
+
 /**
  Initialise paging in the system.
  */
@@ -57,13 +121,59 @@ oserr init_paging(void);
 /**
  Map the specified physical frame to the specified linear address.
  */
-oserr paging_map(paging_info_t info, uintptr_t frame, uintptr_t linear);
+oserr paging_map(paging_info_t info, paddr_t frame, uintptr_t linear);
+
+/**
+ Map the specified physical frame to the specified linear address, without
+ allowing it to be written to. A write to it is reported to the fault handler.
+ */
+oserr paging_map_readonly(paging_info_t info, paddr_t frame, uintptr_t linear);
 
 /**
- Unmap the physical memory from the specified linear memory address.
+ Map the specified block of physical memory to the specified linear address
+ using a single large page. Both addresses must be aligned to the size of a
+ large page.
+ */
+oserr paging_map_large(paging_info_t info, paddr_t frame, uintptr_t linear);
+
+/**
+ Unmap the physical memory from the specified linear memory address. If the
+ address is part of a large page, then the large page is split first.
  */
 oserr paging_unmap(paging_info_t info, uintptr_t linear);
 
+/**
+ Unmap the large page at the specified linear address, returning the entire
+ block of physical memory behind it.
+ */
+oserr paging_unmap_large(paging_info_t info, uintptr_t linear);
+
+/**
+ Map _count_ pages, starting at the specified linear address, to consecutive
+ physical frames starting at _frame_. Each page table is only walked once, and
+ the TLB is invalidated once all of the pages have been mapped. Any page that
+ is already mapped is left as it is.
+ */
+oserr paging_map_range(
+	paging_info_t info, paddr_t frame, uintptr_t linear, uint32_t count
+);
+
+/**
+ Unmap _count_ pages starting at the specified linear address, releasing the
+ frames behind them. Large pages that are entirely within the range are
+ released as a whole, and any others are split first. The TLB is invalidated
+ once all of the pages have been unmapped.
+ */
+oserr paging_unmap_range(paging_info_t info, uintptr_t linear, uint32_t count);
+
+/**
+ Count the number of consecutive pages, up to _max_, that are not mapped
+ starting from the specified linear address.
+ */
+uint32_t paging_count_unmapped(
+	paging_info_t info, uintptr_t linear, uint32_t max
+);
+
 /**
  Switch to the specified paging context.
  */
@@ -73,13 +183,23 @@ oserr paging_set_context(paging_info_t info);
  Translate the specified physical frame into a linear address for the specified
  paging context.
  */
-oserr paging_phys_to_linear(paging_info_t info, uintptr_t frame, uintptr_t *a);
+oserr paging_phys_to_linear(paging_info_t info, paddr_t frame, uintptr_t *a);
+
+/**
+ Find every mapping of the specified physical frame across all paging contexts,
+ copying up to _max_ of them into _mappings_. Returns the total number of
+ mappings. Only mappings made after paging was enabled are known, and frames
+ that are pinned are never recorded.
+ */
+uint32_t paging_frame_mappings(
+	paddr_t frame, struct paging_mapping *mappings, uint32_t max
+);
 
 /**
  Translate the specified linear address into a physical frame for the specified
  paging context.
  */
-oserr paging_linear_to_phys(paging_info_t info, uintptr_t linear, uintptr_t *f);
+oserr paging_linear_to_phys(paging_info_t info, uintptr_t linear, paddr_t *f);
 
 /**
  Enable/Disable paging functionality on the system.
@@ -87,10 +207,38 @@ oserr paging_linear_to_phys(paging_info_t info, uintptr_t linear, uintptr_t *f);
 oserr paging_set_enabled(int flag);
 
 /**
- Determine the first free to use linear address for the specified paging 
- context.
+ A handler for faults on linear addresses that are not mapped, or for writes to
+ pages that are mapped read only. Returns true if the handler resolved the
+ fault, in which case the access is retried.
+ */
+typedef bool(*paging_fault_handler_t)(uintptr_t linear, bool write);
+
+/**
+ Install the handler that is consulted before a fault on a linear address that
+ is not mapped, or is read only, is treated as fatal.
+ */
+void paging_set_fault_handler(paging_fault_handler_t handler);
+
+/**
+ Create a new paging context that is a copy of _info_, which must be the current
+ context. Kernel memory is shared by both contexts. Every page in the private
+ region of the context is shared as well, and is copied by whichever context
+ writes to it first. Returns NULL if the context could not be created.
+ */
+paging_info_t paging_clone_context(paging_info_t info);
+
+/**
+ Release a context created by paging_clone_context(), which must not be the
+ current context. Every page in the private region of the context, and every
+ paging structure that belongs only to it, is released.
  */
-uintptr_t paging_find_linear(paging_info_t info);
+oserr paging_release_context(paging_info_t info);
+
+/**
+ Retrieve the range of linear addresses through which the paging structures of
+ a context are accessed. Nothing else may ever be mapped within the range.
+ */
+void paging_window_range(uintptr_t *start, uintptr_t *end);
 
 /**
  Make sure any paging structures and caches are correctly flushed out to the CPU
@@ -98,4 +246,20 @@ uintptr_t paging_find_linear(paging_info_t info);
  */
 void paging_flush(void);
 
+/**
+ Retrieve the current TLB invalidation statistics.
+ */
+void paging_get_tlb_stats(struct paging_tlb_stats *stats);
+
+/**
+ Temporarily map the specified physical frame into one of the reserved slots,
+ so that its contents can be accessed. Returns the linear address of the slot.
+ */
+uintptr_t paging_map_temporary(enum paging_slot slot, paddr_t frame);
+
+/**
+ Remove the temporary mapping from the specified slot.
+ */
+void paging_unmap_temporary(enum paging_slot slot);
+
 #endif
\ No newline at end of file
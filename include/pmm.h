@@ -29,6 +29,37 @@
 
 /* Frames are 4KiB in size */
 #define FRAME_SIZE	0x1000
+#define FRAME_SHIFT	12
+
+/* The largest block the buddy allocator manages is 2^PMM_MAX_ORDER frames. An
+   order of 10 gives 4MiB blocks, which is enough to back a large page in any
+   of the paging modes. */
+#define PMM_MAX_ORDER	10
+
+/* Frames can be colored by the cache sets that they occupy. Frame n has the
+   color n modulo the number of colors, which is at most PMM_MAX_COLORS. At
+   most PMM_MAX_COLORED frames are held aside, sorted by color. */
+#define PMM_MAX_COLORS		64
+#define PMM_MAX_COLORED		(4 * PMM_MAX_COLORS)
+
+/* Request a frame of the next color in turn, so that successive requests are
+   spread evenly across the cache. */
+#define PMM_COLOR_DIVERSE	0xFFFFFFFF
+
+/**
+ Statistics about colored frame allocation.
+ 	- colors	The number of colors in use, or 1 if coloring is disabled.
+ 	- held		Frames currently held aside, sorted by color.
+ 	- hits		Requests that were given a frame of the requested color.
+ 	- misses	Requests that had to be given a frame of another color.
+ */
+struct pmm_color_stats
+{
+	uint32_t colors;
+	uint32_t held;
+	uint32_t hits;
+	uint32_t misses;
+};
 
 /**
  Physical frame purposes. What is the frame being used for in the system? How
@@ -43,7 +74,20 @@ enum frame_purpose
 	frame_kernel_wired, 
 	frame_module, 
 	frame_video, 
-	frame_context
+	frame_context,
+	frame_paging,
+	frame_purpose_count
+};
+
+/**
+ Physical frame flags. These record additional information about how a frame
+ should be treated by the Physical Memory Manager.
+ 	- frame_pinned	The frame must never be returned to the available pool,
+ 					regardless of how many references to it are released.
+ */
+enum frame_flag
+{
+	frame_pinned = (1 << 0),
 };
 
 /**
@@ -59,13 +103,12 @@ enum align_behaviour
 
 /**
  Used for recording frame purposes. It can keep track of how the frame is being
- used, what its linear address mapping is and in which page directory it was
- originally mapped.
+ used, and any flags that affect how it is managed.
  */
 union frame {
 	struct {
 		uint8_t purpose:4;
-		uint8_t unused:4;
+		uint8_t flags:4;
 	} __attribute__((packed)) s;
 	uint8_t v;
 };
@@ -86,29 +129,130 @@ oserr init_physical_memory(struct multiboot_info *mb);
  Determine what the purpose of the specified frame is. This address _must_ be
  a physical address, not a linear address.
  */
-enum frame_purpose pmm_frame_purpose(uintptr_t frame);
+enum frame_purpose pmm_frame_purpose(paddr_t frame);
 
 /**
  Record the purpose of a frame in the Physical Memory Manager.
  */
-oserr pmm_set_frame_purpose(uintptr_t frame, enum frame_purpose purpose);
+oserr pmm_set_frame_purpose(paddr_t frame, enum frame_purpose purpose);
+
+/**
+ Retrieve or replace the flags of the specified frame.
+ */
+uint8_t pmm_frame_flags(paddr_t frame);
+oserr pmm_set_frame_flags(paddr_t frame, uint8_t flags);
+
+/**
+ The number of frames that currently have the specified purpose.
+ */
+uint32_t pmm_frame_count(enum frame_purpose purpose);
+
+/**
+ Add a reference to a frame that has already been acquired. The frame will not
+ become available again until every reference to it has been released.
+ */
+oserr pmm_retain_frame(paddr_t frame);
+
+/**
+ The number of references currently held on the specified frame.
+ */
+uint32_t pmm_frame_references(paddr_t frame);
 
 /**
  Acquire an available frame from the Physical Memory Manager.
  */
-uintptr_t pmm_acquire_frame(void);
+paddr_t pmm_acquire_frame(void);
 
 /**
- Return a frame back to the Physical Memory Manager so that it may become
+ Release a reference to a frame. Once the last reference has been released the
+ frame is returned to the Physical Memory Manager so that it may become 
  available for use again.
  */
-oserr pmm_release_frame(uintptr_t frame);
+oserr pmm_release_frame(paddr_t frame);
+
+/**
+ Acquire a block of 2^order physically contiguous frames from the Physical
+ Memory Manager. The block is aligned to its own size, or to _align_ bytes if
+ that is larger. Returns 0 if no suitable block is available.
+ */
+paddr_t pmm_acquire_frames(uint32_t order, uint32_t align);
+
+/**
+ Return a block of 2^order frames, previously acquired with 
+ pmm_acquire_frames(), back to the Physical Memory Manager.
+ */
+oserr pmm_release_frames(paddr_t frame, uint32_t order);
+
+/**
+ Split a block of 2^order frames, previously acquired with pmm_acquire_frames(),
+ into individual frames. Each frame can then be released on its own using
+ pmm_release_frame().
+ */
+oserr pmm_split_frames(paddr_t frame, uint32_t order);
+
+/**
+ Acquire an available frame of the specified color, or of the next color in
+ turn if _color_ is PMM_COLOR_DIVERSE. The color is taken modulo the number of
+ colors. If no frame of the color can be found then a frame of any color is
+ returned instead. This is the same as pmm_acquire_frame() when coloring is
+ disabled.
+ */
+paddr_t pmm_acquire_colored_frame(uint32_t color);
+
+/**
+ Set the number of frame colors, which is rounded down to a power of two no
+ larger than PMM_MAX_COLORS. A count of 1 disables coloring.
+ */
+void pmm_set_frame_colors(uint32_t colors);
+
+/**
+ The number of frame colors in use, or 1 if coloring is disabled.
+ */
+uint32_t pmm_frame_colors(void);
+
+/**
+ The color of the specified frame.
+ */
+uint32_t pmm_frame_color(paddr_t frame);
+
+/**
+ Retrieve statistics about colored frame allocation.
+ */
+void pmm_get_color_stats(struct pmm_color_stats *stats);
+
+/**
+ The number of frames that are currently available for use.
+ */
+uint32_t pmm_available_frames(void);
 
 /**
  Retrieve the physical memory range of a particular item.
  */
 oserr pmm_frame_range(enum frame_purpose purpose, uintptr_t *s, uintptr_t *e);
 
+/**
+ Check if the system has physical memory beyond 4GiB, that can only be used
+ once the paging code is able to address it.
+ */
+bool pmm_has_high_memory(void);
+
+/**
+ Make any physical memory beyond 4GiB available for use. This must only be
+ called once the paging code is able to map such memory.
+ */
+void pmm_enable_high_memory(void);
+
+/**
+ Retrieve the physical memory range occupied by the frame table.
+ */
+void pmm_table_range(uintptr_t *s, uintptr_t *e);
+
+/**
+ Inform the Physical Memory Manager that the frame table is now accessed at the
+ specified linear address. This must be done as soon as paging is enabled.
+ */
+void pmm_relocate_table(uintptr_t linear);
+
 /**
  Align specified memory address to a frame boundary.
  */
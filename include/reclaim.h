@@ -0,0 +1,128 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#if !defined(RECLAIM_H)
+#define RECLAIM_H
+
+#include <types.h>
+
+/* Up to RECLAIM_MAX_SHRINKERS subsystems can offer memory back to the system
+   when it is running low. */
+#define RECLAIM_MAX_SHRINKERS	16
+
+/* Once fewer than RECLAIM_LOW_FRAMES frames are free, the idle thread reclaims
+   memory until RECLAIM_HIGH_FRAMES are free again. */
+#define RECLAIM_LOW_FRAMES		256
+#define RECLAIM_HIGH_FRAMES		1024
+
+/* The number of frames that an allocation attempts to reclaim for itself
+   before the system is considered to be out of memory. */
+#define RECLAIM_DIRECT_FRAMES	32
+
+/**
+ Shrinker callbacks. The count callback returns an estimate of the number of
+ frames that the subsystem could give back. The scan callback attempts to give
+ back _count_ frames and returns the number that it did. Either may be called
+ with interrupts disabled, or whilst the subsystem's own locks are held by the
+ caller, so neither may wait.
+ */
+typedef uint32_t(*reclaim_count_t)(void *data);
+typedef uint32_t(*reclaim_scan_t)(void *data, uint32_t count);
+
+/**
+ A subsystem that can give memory back when the system is running low.
+ 	- name		A description of the memory that is given back.
+ 	- count		Estimates the number of frames that could be given back.
+ 	- scan		Gives back frames.
+ 	- data		Passed to both callbacks.
+ 	- calls		The number of times that the shrinker has been scanned.
+ 	- freed		The number of frames that the shrinker has given back.
+ */
+struct reclaim_shrinker
+{
+	const char *name;
+	reclaim_count_t count;
+	reclaim_scan_t scan;
+	void *data;
+	uint32_t calls;
+	uint32_t freed;
+};
+
+/**
+ Statistics about memory reclaim.
+ 	- background	Reclaims started because free frames fell below the low
+ 					watermark.
+ 	- direct		Reclaims made by allocations that found no free frames.
+ 	- failures		Direct reclaims that were unable to free anything.
+ */
+struct reclaim_stats
+{
+	uint32_t background;
+	uint32_t direct;
+	uint32_t failures;
+};
+
+/**
+ Register the shrinkers of the core memory subsystems: the pre-zeroed frame
+ pool, the empty slabs of object caches, and the retained pages of the kernel
+ heap. This must be called once the kernel context has been setup.
+ */
+oserr init_reclaim(void);
+
+/**
+ Register a shrinker. Shrinkers are scanned in the order that they were
+ registered, so the cheapest memory to give back should be registered first.
+ */
+oserr reclaim_register(
+	const char *name, reclaim_count_t count, reclaim_scan_t scan, void *data
+);
+
+/**
+ Attempt to reclaim _count_ frames immediately, on behalf of an allocation that
+ could not otherwise be satisfied. Returns the number of frames reclaimed.
+ */
+uint32_t reclaim_frames(uint32_t count);
+
+/**
+ Reclaim memory if free frames have fallen below the low watermark. This is
+ intended to be called whenever the system would otherwise be idle. Returns
+ true if any memory was reclaimed.
+ */
+bool reclaim_background(void);
+
+/**
+ Check if free frames are below the high watermark, in which case memory
+ should not be set aside for caches.
+ */
+bool reclaim_pressure(void);
+
+/**
+ Retrieve the shrinker at _index_, or NULL if there is not one.
+ */
+const struct reclaim_shrinker *reclaim_get_shrinker(uint32_t index);
+
+/**
+ Retrieve statistics about memory reclaim.
+ */
+void reclaim_get_stats(struct reclaim_stats *stats);
+
+#endif
\ No newline at end of file
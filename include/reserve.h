@@ -0,0 +1,82 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#if !defined(RESERVE_H)
+#define RESERVE_H
+
+#include <types.h>
+
+/* The reserve holds RESERVE_OBJECTS allocations of each of RESERVE_CLASSES
+   sizes. Class n holds allocations of 2^(RESERVE_MIN_SHIFT + 2n) bytes, so the
+   classes are 64, 256, 1024 and 4096 bytes. */
+#define RESERVE_CLASSES		4
+#define RESERVE_MIN_SHIFT	6
+#define RESERVE_OBJECTS		16
+
+/* The number of physical frames held by the reserve. */
+#define RESERVE_FRAMES		16
+
+/**
+ Statistics about the emergency reserve.
+ 	- objects	The number of allocations currently held in each class.
+ 	- frames	The number of physical frames currently held.
+ 	- hits		Requests that were satisfied by the reserve.
+ 	- misses	Requests that could not be satisfied, as the reserve was empty.
+ 	- refills	Allocations and frames that have been added to the reserve.
+ */
+struct reserve_stats
+{
+	uint32_t objects[RESERVE_CLASSES];
+	uint32_t frames;
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t refills;
+};
+
+/**
+ Take an allocation of at least _size_ bytes from the reserve. This never waits
+ and never touches the heap, so it can be used from an interrupt handler. The
+ memory is already mapped, and is released with kfree() once it is no longer
+ needed. Returns NULL if the reserve has nothing large enough.
+ */
+void *reserve_alloc(uint32_t size);
+
+/**
+ Take a physical frame from the reserve. This never waits, so it can be used
+ from an interrupt handler. The frame is released with pmm_release_frame().
+ Returns 0 if the reserve has no frames left.
+ */
+paddr_t reserve_acquire_frame(void);
+
+/**
+ Replace a single allocation or frame that has been taken from the reserve.
+ This must only be called from a thread, never from an interrupt handler.
+ Returns false if the reserve is already full.
+ */
+bool reserve_refill(void);
+
+/**
+ Retrieve statistics about the emergency reserve.
+ */
+void reserve_get_stats(struct reserve_stats *stats);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,122 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#if !defined(SLAB_H)
+#define SLAB_H
+
+#include <types.h>
+
+/* Alignment to request for objects that should not share a cache line. */
+#define KMEM_CACHE_LINE		64
+
+/* The maximum number of object caches that can exist at once. */
+#define KMEM_MAX_CACHES		32
+
+/**
+ Constructor for the objects of a cache. It is called once for each object when
+ the slab holding it is created, rather than on every allocation. Objects must
+ be returned to the cache in their constructed state.
+ */
+typedef void(*kmem_ctor_t)(void *object);
+
+/**
+ A slab of objects. The slab header occupies the start of the slab's pages, and
+ the objects follow it. Slabs are aligned to their size, so the slab holding an
+ object is found by masking the object's address.
+ 	- cache		The cache that the slab belongs to.
+ 	- next		The next slab in the same list of the cache.
+ 	- back		The previous slab in the same list of the cache.
+ 	- free		The first free object in the slab.
+ 	- inuse		The number of objects that are allocated from the slab.
+ */
+struct kmem_slab
+{
+	struct kmem_cache *cache;
+	struct kmem_slab *next;
+	struct kmem_slab *back;
+	void *free;
+	uint32_t inuse;
+};
+
+/**
+ A cache of fixed size objects.
+ 	- name		A description of the objects in the cache.
+ 	- size		The size of each object, as requested.
+ 	- stride	The distance between consecutive objects in a slab.
+ 	- link		The offset of the free list link within a free object.
+ 	- offset	The offset of the first object from the start of a slab.
+ 	- pages		The number of pages in each slab.
+ 	- capacity	The number of objects in each slab.
+ 	- ctor		The constructor for new objects, or NULL.
+ 	- partial	Slabs that have both allocated and free objects.
+ 	- empty		Slabs that have no allocated objects.
+ 	- slabs		The number of slabs that the cache holds.
+ 	- objects	The number of allocated objects.
+ */
+struct kmem_cache
+{
+	const char *name;
+	uint32_t size;
+	uint32_t stride;
+	uint32_t link;
+	uint32_t offset;
+	uint32_t pages;
+	uint32_t capacity;
+	kmem_ctor_t ctor;
+	struct kmem_slab *partial;
+	struct kmem_slab *empty;
+	uint32_t slabs;
+	uint32_t objects;
+};
+
+/**
+ Create a cache of objects of _size_ bytes, each aligned to _align_ bytes. An
+ alignment of 0 uses the natural word alignment. The optional _ctor_ is used to
+ construct new objects. Returns NULL if the cache could not be created.
+ */
+struct kmem_cache *kmem_cache_create(
+	const char *name, uint32_t size, uint32_t align, kmem_ctor_t ctor
+);
+
+/**
+ Allocate an object from the cache. Returns NULL if no memory is available.
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache);
+
+/**
+ Return an object to the cache that it was allocated from.
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *object);
+
+/**
+ Release the empty slabs that caches hold on to, until at least _count_ pages
+ have been released or there are none left. Returns the number of pages
+ released.
+ */
+uint32_t kmem_shrink(uint32_t count);
+
+/**
+ Retrieve the object cache at _index_, or NULL if there is not one.
+ */
+const struct kmem_cache *kmem_get_cache(uint32_t index);
+
+#endif
\ No newline at end of file
@@ -24,6 +24,7 @@
 #define THREAD_H
 
 #include <types.h>
+#include <alloc.h>
 
 #define MAX_THREADS		0x400	/* 1024 Threads is the maximum allowed. */
 
@@ -75,6 +76,9 @@ struct thread
 	uint64_t suspended_time;
 	uint64_t wake_time;
 	uint64_t suspend_time;
+	/* The structure is packed, but the cache is used through a pointer and so
+	   must be aligned. */
+	struct kalloc_cache allocs __attribute__((aligned(4)));
 } __attribute__((packed));
 
 extern struct thread *kernel_main_thread;
@@ -85,6 +89,12 @@ extern struct thread *kernel_main_thread;
  */
 oserr init_threading(void);
 
+/**
+ Get the thread that is currently running, or NULL if threading has not been
+ setup yet.
+ */
+struct thread *current_thread(void);
+
 /**
  Create a new thread, with the specified starting point.
  */
@@ -35,6 +35,13 @@ int64_t time(void);
  */
 uint64_t uptime_ms(void);
 
+/**
+ A free running count of CPU cycles. This is only useful for measuring the
+ duration of short operations, and is available before any timers have been
+ configured.
+ */
+uint64_t cpu_ticks(void);
+
 /**
  Returns the number of seconds since January 1st, 1970. Negative values 
  indicate seconds prior to 1970.
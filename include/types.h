@@ -47,6 +47,10 @@
 	typedef __kernel_unative_t           __kernel_uintptr_t;
 	typedef __kernel_native_t            __kernel_intptr_t;
 
+	/* Physical addresses can be wider than pointers when physical address
+	   extensions are in use. */
+	typedef __kernel_uint64_t            __kernel_paddr_t;
+
 	/* Useful error types and return codes. */
 	typedef __kernel_native_t            oserr;
 
@@ -68,6 +72,7 @@
 		typedef __kernel_native_t        native_t;
 		typedef __kernel_uintptr_t       uintptr_t;
 		typedef __kernel_intptr_t        intptr_t;
+		typedef __kernel_paddr_t         paddr_t;
 
 #		if !defined(NULL)
 #			define NULL                  ((void *)0)
@@ -0,0 +1,91 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#if !defined(VMALLOC_H)
+#define VMALLOC_H
+
+#include <types.h>
+
+/* Areas are found from their address through a hash table with this many
+   chains. */
+#define VMALLOC_BUCKETS		64
+
+/* Large allocations are made from a window at the top of kernel memory, which
+   is kept out of the kernel heap. Together they can hold at most 256MiB. */
+#define VMALLOC_BASE		0x30000000
+#define VMALLOC_LIMIT		0x40000000
+
+/**
+ A run of pages that is given to a single large allocation.
+ 	- base		The first page, which is also the address of the allocation.
+ 	- pages		The number of pages in the run.
+ 	- next		The next area in the same hash chain.
+ */
+struct vmalloc_area
+{
+	uintptr_t base;
+	uint32_t pages;
+	struct vmalloc_area *next;
+};
+
+/**
+ Statistics about the large allocations that are currently held.
+ 	- areas		The number of large allocations.
+ 	- pages		The number of pages that they occupy.
+ */
+struct vmalloc_stats
+{
+	uint32_t areas;
+	uint32_t pages;
+};
+
+/**
+ Reserve the window that large allocations are made from, so that none of its
+ linear addresses are used for anything else. This must be done before the
+ kernel context is created.
+ */
+oserr init_vmalloc(void);
+
+/**
+ Allocate a run of whole pages that can hold _size_ bytes. The allocation is
+ aligned to a page, or to _align_ bytes if that is larger, which must be a
+ power of two. Returns NULL if the pages could not be acquired.
+ */
+void *vmalloc(uint32_t size, uint32_t align);
+
+/**
+ Release an allocation made by vmalloc(), returning all of its pages at once.
+ */
+void vfree(void *ptr);
+
+/**
+ Get the number of bytes that can be used in an allocation made by vmalloc(),
+ which is all of its pages. Returns 0 if the pointer is not such an allocation.
+ */
+uint32_t vmalloc_size(void *ptr);
+
+/**
+ Retrieve statistics about the large allocations that are currently held.
+ */
+void vmalloc_get_stats(struct vmalloc_stats *stats);
+
+#endif
\ No newline at end of file
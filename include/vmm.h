@@ -25,6 +25,37 @@
 
 #include <types.h>
 
+/**
+ Statistics about the behaviour of the virtual memory manager.
+ 	- zero_pool_frames	Pre-zeroed frames currently waiting in the pool.
+ 	- zero_pool_hits	Pages that were backed by a frame from the pool.
+ 	- zero_pool_misses	Pages that had to be zeroed as they were acquired.
+ 	- zero_page_mappings	Pages that were mapped to the shared zero page.
+ */
+struct vmm_stats
+{
+	uint32_t zero_pool_frames;
+	uint32_t zero_pool_hits;
+	uint32_t zero_pool_misses;
+	uint32_t zero_page_mappings;
+};
+
+/**
+ A range of linear addresses whose pages are only acquired when they are first
+ accessed.
+ 	- name		A description of what the region is used for.
+ 	- base		The first address of the region.
+ 	- limit		The address immediately after the region.
+ 	- faults	Pages that have been acquired in response to a fault.
+ */
+struct vmm_region
+{
+	const char *name;
+	uintptr_t base;
+	uintptr_t limit;
+	uint32_t faults;
+};
+
 /**
  Initialise the virtual memory manager.
  */
@@ -36,16 +67,73 @@ oserr init_virtual_memory(void);
  */
 bool vmm_address_valid(uintptr_t address);
 
+/**
+ Check if the page containing _linear_ is known to read as zero. This is the
+ case for pages of a demand paged region that have not been written to.
+ */
+bool vmm_page_is_zero(uintptr_t linear);
+
 /**
  Acquire a new page from the virtual memory manager
  */
 uintptr_t vmm_acquire_any_page(void);
 
+/**
+ Acquire a run of _count_ new pages from the virtual memory manager. The first
+ page is aligned to _align_ pages, which must be a power of two. The pages are
+ always in kernel memory, and are shared by every context.
+ */
+uintptr_t vmm_acquire_any_pages(uint32_t count, uint32_t align);
+
+/**
+ Map _count_ specific frames to a run of new pages, in the order given. The
+ frames are owned by the mapping from then on, even if it fails, and are
+ released along with it by vmm_release_any_pages(). Returns 0 on failure.
+ */
+uintptr_t vmm_map_frames(const paddr_t *frames, uint32_t count);
+
+/**
+ Release a run of pages that was acquired through vmm_acquire_any_pages(), so
+ that both the frames and the linear addresses can be used again.
+ */
+oserr vmm_release_any_pages(uintptr_t linear, uint32_t count);
+
+/**
+ Reserve the linear addresses in the range of _first_ to _last_ so that they
+ are never returned by vmm_acquire_any_page(). The owner of the range is then
+ responsible for acquiring and releasing pages within it.
+ */
+oserr vmm_reserve_pages(uintptr_t first, uintptr_t last);
+
+/**
+ Reserve the linear addresses in the range of _base_ to _limit_, and acquire
+ each page within it the first time that it is accessed. Pages can still be
+ released explicitly, and will be acquired again if accessed later.
+ */
+oserr vmm_create_region(const char *name, uintptr_t base, uintptr_t limit);
+
+/**
+ Retrieve the demand paged region at _index_, or NULL if there is not one.
+ */
+const struct vmm_region *vmm_get_region(uint32_t index);
+
+/**
+ Count the pages in the range of _first_ to _last_ that are currently mapped.
+ */
+uint32_t vmm_count_acquired(uintptr_t first, uintptr_t last);
+
 /**
  Acquire a specific page from the virtual memory manager.
  */
 oserr vmm_acquire_page(uintptr_t linear);
 
+/**
+ Acquire all of the pages in the range of _first_ to _last_. Any part of the
+ range that covers an entire large page will be mapped using a large page if
+ the physical memory manager is able to supply one.
+ */
+oserr vmm_acquire_pages(uintptr_t first, uintptr_t last);
+
 /**
  Release the specified page, returning the frame back to the phyiscal memory
  manager, and marking the page as not present.
@@ -58,4 +146,22 @@ oserr vmm_release_page(uintptr_t linear);
  */
 oserr vmm_release_pages(uintptr_t first, uintptr_t last);
 
+/**
+ Prepare a single zeroed frame for the pre-zeroed frame pool. This is intended
+ to be called whenever the system would otherwise be idle. Returns false if the
+ pool is already full, or if free frames are running low.
+ */
+bool vmm_prepare_zeroed_frame(void);
+
+/**
+ Return up to _count_ frames from the pre-zeroed frame pool to the physical
+ memory manager. Returns the number of frames returned.
+ */
+uint32_t vmm_release_zeroed_frames(uint32_t count);
+
+/**
+ Retrieve the current statistics of the virtual memory manager.
+ */
+void vmm_get_stats(struct vmm_stats *stats);
+
 #endif
\ No newline at end of file
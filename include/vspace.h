@@ -0,0 +1,99 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#if !defined(VIRTUAL_SPACE_H)
+#define VIRTUAL_SPACE_H
+
+#include <types.h>
+
+/* Extents are recorded by the space itself. A small number are available from
+   the start, and more are carved from pages of the space when they run out. */
+#define VSPACE_INITIAL_EXTENTS	16
+
+/**
+ A run of free pages within a virtual address space. Extents are kept in an AVL
+ tree ordered by their first page, with each extent also recording the largest
+ run of free pages in its subtree.
+ */
+struct vspace_extent
+{
+	uint32_t first;
+	uint32_t pages;
+	uint32_t largest;
+	int32_t height;
+	struct vspace_extent *left;
+	struct vspace_extent *right;
+};
+
+/**
+ A range of linear addresses from which runs of pages can be allocated. Every
+ operation on the space takes logarithmic time in the number of free extents.
+ 	- first		The first page that the space covers.
+ 	- limit		The page immediately after the space.
+ 	- root		The root of the free extent tree.
+ 	- spare		Extents that are not currently in use.
+ 	- spares	The number of spare extents.
+ 	- pages		The number of free pages in the space.
+ */
+struct vspace
+{
+	uint32_t first;
+	uint32_t limit;
+	struct vspace_extent *root;
+	struct vspace_extent *spare;
+	uint32_t spares;
+	uint32_t pages;
+	struct vspace_extent initial[VSPACE_INITIAL_EXTENTS];
+};
+
+/**
+ Initialise a virtual space covering the linear addresses from _base_ up to,
+ but not including, _limit_. The entire space is initially free.
+ */
+oserr init_vspace(struct vspace *space, uintptr_t base, uintptr_t limit);
+
+/**
+ Allocate a run of _count_ free pages from the space. The first page of the
+ run is aligned to _align_ pages, which must be a power of two. The lowest
+ suitable run is used. Returns 0 if no such run exists.
+ */
+uintptr_t vspace_allocate(struct vspace *space, uint32_t count, uint32_t align);
+
+/**
+ Return a run of _count_ pages starting at _linear_ to the space, so that it
+ can be allocated again.
+ */
+oserr vspace_release(struct vspace *space, uintptr_t linear, uint32_t count);
+
+/**
+ Ensure that none of the _count_ pages starting at _linear_ are ever allocated
+ from the space. Any part of the range that is outside of the space, or is
+ already in use, is ignored.
+ */
+oserr vspace_reserve(struct vspace *space, uintptr_t linear, uint32_t count);
+
+/**
+ Returns the number of free pages remaining in the space.
+ */
+uint32_t vspace_free_pages(struct vspace *space);
+
+#endif
\ No newline at end of file
@@ -22,8 +22,200 @@
 
 #include <alloc.h>
 #include <heap.h>
+#include <vmalloc.h>
+#include <reserve.h>
+#include <vmm.h>
+#include <string.h>
 #include <context.h>
+#include <thread.h>
 #include <print.h>
+#include <arch.h>
+#include <heapprof.h>
+#include <alloctrace.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define KALLOC_LIMIT	(1U << (KALLOC_MIN_SHIFT + KALLOC_CLASSES - 1))
+
+/* The code that called the allocator, to which allocations are attributed. */
+#define KALLOC_CALLER	((uintptr_t)__builtin_return_address(0))
+
+static inline uint32_t kalloc_class_size(uint32_t class)
+{
+	return 1U << (KALLOC_MIN_SHIFT + class);
+}
+
+static inline uint32_t kalloc_alloc_class(uint32_t size)
+{
+	/* The smallest class that every request of the size fits in. */
+	if (size <= kalloc_class_size(0)) {
+		return 0;
+	}
+	return 32 - __builtin_clz(size - 1) - KALLOC_MIN_SHIFT;
+}
+
+static inline int32_t kalloc_free_class(uint32_t size)
+{
+	/* The largest class that the allocation can satisfy any request of. */
+	if (size < kalloc_class_size(0) || size >= 2 * KALLOC_LIMIT) {
+		return -1;
+	}
+	return 31 - __builtin_clz(size) - KALLOC_MIN_SHIFT;
+}
+
+static struct kalloc_cache *kalloc_thread_cache(struct heap *heap)
+{
+	/* Must be called with interrupts disabled, as the cache belongs to the
+	   current thread and an interrupt could otherwise use it as well. */
+	struct thread *thread = current_thread();
+	if (!thread) {
+		return NULL;
+	}
+
+	struct kalloc_cache *cache = &thread->allocs;
+	if (cache->heap != heap) {
+		kalloc_flush_cache(cache);
+		cache->heap = heap;
+	}
+	return cache;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void kalloc_init_cache(struct kalloc_cache *cache)
+{
+	cache->heap = NULL;
+	for (uint32_t i = 0; i < KALLOC_CLASSES; ++i) {
+		cache->magazines[i].count = 0;
+	}
+}
+
+void kalloc_flush_cache(struct kalloc_cache *cache)
+{
+	for (uint32_t i = 0; i < KALLOC_CLASSES; ++i) {
+		struct kalloc_magazine *magazine = &cache->magazines[i];
+		if (magazine->count) {
+			heap_dealloc_batch(cache->heap, magazine->objects, magazine->count);
+			magazine->count = 0;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void *kalloc_from_heap(struct heap *heap, uint32_t size)
+{
+	if (size >= KALLOC_LARGE_SIZE) {
+		return vmalloc(size, 0);
+	}
+	else if (size > KALLOC_LIMIT) {
+		return heap_alloc(heap, size);
+	}
+
+	/* Small allocations are taken from the thread's magazine, which is only
+	   refilled from the heap once it is empty. */
+	uint32_t class = kalloc_alloc_class(size);
+	uintptr_t flags = irq_save();
+	struct kalloc_cache *cache = kalloc_thread_cache(heap);
+	if (!cache) {
+		irq_restore(flags);
+		return heap_alloc(heap, kalloc_class_size(class));
+	}
+
+	void *ptr = NULL;
+	struct kalloc_magazine *magazine = &cache->magazines[class];
+	if (magazine->count == 0) {
+		magazine->count = heap_alloc_batch(
+			heap, kalloc_class_size(class), magazine->objects,
+			KALLOC_MAGAZINE_SIZE / 2
+		);
+	}
+	if (magazine->count) {
+		ptr = magazine->objects[--magazine->count];
+	}
+	irq_restore(flags);
+
+	return ptr;
+}
+
+static void kfree_to_heap(struct heap *heap, void *ptr)
+{
+	if (vmalloc_size(ptr)) {
+		vfree(ptr);
+		return;
+	}
+
+	/* Small allocations are kept in the thread's magazine. Once it is full,
+	   half of it is returned to the heap. */
+	uint32_t size = heap_alloc_size(heap, ptr);
+	int32_t class = kalloc_free_class(size);
+	if (class < 0) {
+		if (size) {
+			heap_dealloc(heap, ptr);
+		}
+		return;
+	}
+
+	uintptr_t flags = irq_save();
+	struct kalloc_cache *cache = kalloc_thread_cache(heap);
+	if (!cache) {
+		irq_restore(flags);
+		heap_dealloc(heap, ptr);
+		return;
+	}
+
+	struct kalloc_magazine *magazine = &cache->magazines[class];
+	if (magazine->count == KALLOC_MAGAZINE_SIZE) {
+		magazine->count = KALLOC_MAGAZINE_SIZE / 2;
+		heap_dealloc_batch(
+			heap, &magazine->objects[magazine->count],
+			KALLOC_MAGAZINE_SIZE / 2
+		);
+	}
+	magazine->objects[magazine->count++] = ptr;
+	irq_restore(flags);
+}
+
+static void *kcalloc_pages(uint32_t size)
+{
+	/* Pages that are known to read as zero do not need to be cleared. */
+	uint8_t *ptr = vmalloc(size, 0);
+	for (uint32_t offset = 0; ptr && offset < size; offset += PAGE_SIZE) {
+		if (!vmm_page_is_zero((uintptr_t)ptr + offset)) {
+			memset(ptr + offset, 0, MIN(PAGE_SIZE, size - offset));
+		}
+	}
+	return ptr;
+}
+
+static void *krealloc_pages(
+	struct heap *heap, void *ptr, uint32_t usable, uint32_t size
+) {
+	if (size == 0) {
+		kfree_to_heap(heap, ptr);
+		return NULL;
+	}
+
+	/* A large allocation stays where it is if it still needs all of its
+	   pages. Otherwise the allocation moves between the heap and pages of its
+	   own, or to a different number of pages. */
+	uint32_t needed = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	if (usable && size >= KALLOC_LARGE_SIZE && needed == usable) {
+		return ptr;
+	}
+
+	void *moved = kalloc_from_heap(heap, size);
+	if (moved && ptr) {
+		if (!usable) {
+			usable = heap_alloc_size(heap, ptr);
+		}
+		memcpy(moved, ptr, MIN(usable, size));
+		kfree_to_heap(heap, ptr);
+	}
+	return moved;
+}
+
+////////////////////////////////////////////////////////////////////////////////
 
 void *kalloc(uint32_t size)
 {
@@ -32,7 +224,95 @@ void *kalloc(uint32_t size)
 		klogc(swarn, "*** Attempted to use kalloc() with no active context\n");
 		return NULL;
 	}
-	return heap_alloc(ctx->heap, size);
+
+	void *ptr = kalloc_from_heap(ctx->heap, size);
+	heapprof_alloc(KALLOC_CALLER, ptr, size);
+	if (ptr) {
+		alloc_trace(alloc_trace_alloc, size, ptr, 0);
+	}
+	return ptr;
+}
+
+void *kalloc_aligned(uint32_t size, uint32_t align)
+{
+	struct context *ctx = current_context();
+	if (!ctx) {
+		klogc(swarn, "*** Attempted to use kalloc_aligned() with no active "
+			"context\n");
+		return NULL;
+	}
+
+	void *ptr = (size >= KALLOC_LARGE_SIZE)
+		? vmalloc(size, align)
+		: heap_alloc_aligned(ctx->heap, size, align);
+	heapprof_alloc(KALLOC_CALLER, ptr, size);
+	if (ptr) {
+		alloc_trace(alloc_trace_aligned, size, align, ptr);
+	}
+	return ptr;
+}
+
+void *__kalloc_unrecorded(uint32_t size)
+{
+	struct context *ctx = current_context();
+	return ctx ? kalloc_from_heap(ctx->heap, size) : NULL;
+}
+
+void *kalloc_atomic(uint32_t size)
+{
+	void *ptr = reserve_alloc(size);
+	heapprof_alloc(KALLOC_CALLER, ptr, size);
+	if (ptr) {
+		alloc_trace(alloc_trace_alloc, size, ptr, 0);
+	}
+	return ptr;
+}
+
+void *kcalloc(uint32_t count, uint32_t size)
+{
+	struct context *ctx = current_context();
+	if (!ctx) {
+		klogc(swarn, "*** Attempted to use kcalloc() with no active context\n");
+		return NULL;
+	}
+
+	if (size && count > (uint32_t)~0 / size) {
+		klogc(swarn, "Allocation of %d objects of %d bytes overflows.\n",
+			count, size);
+		return NULL;
+	}
+
+	void *ptr = (count * size >= KALLOC_LARGE_SIZE)
+		? kcalloc_pages(count * size)
+		: heap_calloc(ctx->heap, count, size);
+	heapprof_alloc(KALLOC_CALLER, ptr, count * size);
+	if (ptr) {
+		alloc_trace(alloc_trace_calloc, count * size, ptr, 0);
+	}
+	return ptr;
+}
+
+void *krealloc(void *ptr, uint32_t size)
+{
+	struct context *ctx = current_context();
+	if (!ctx) {
+		klogc(swarn, "*** Attempted to use krealloc() with no active "
+			"context\n");
+		return NULL;
+	}
+
+	/* The original allocation is only gone if the resize succeeded, or if
+	   it was a request to free it. */
+	uint32_t usable = vmalloc_size(ptr);
+	void *moved = (usable || size >= KALLOC_LARGE_SIZE)
+		? krealloc_pages(ctx->heap, ptr, usable, size)
+		: heap_realloc(ctx->heap, ptr, size);
+	if (moved || size == 0) {
+		heapprof_free(ptr);
+		heapprof_alloc(KALLOC_CALLER, moved, size);
+		alloc_trace(alloc_trace_realloc, ptr, size, moved);
+	}
+	return moved;
 }
 
 void kfree(void *ptr)
@@ -42,5 +322,10 @@ void kfree(void *ptr)
 		klogc(swarn, "*** Attempted to use kfree() with no active context\n");
 		return;
 	}
-	heap_dealloc(ctx->heap, ptr);
-}
+
+	heapprof_free(ptr);
+	if (ptr) {
+		alloc_trace(alloc_trace_free, ptr, 0, 0);
+	}
+	kfree_to_heap(ctx->heap, ptr);
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#if defined(ALLOC_TRACE)
+
+#include <alloctrace.h>
+#include <serial.h>
+#include <arch.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void __alloc_trace_field(uint32_t value)
+{
+	for (uint32_t n = 0; n < sizeof(value); ++n) {
+		putc_serial((char)((value >> (n * 8)) & 0xFF));
+	}
+}
+
+void __alloc_trace(
+	enum alloc_trace_event event, uint32_t a, uint32_t b, uint32_t c
+) {
+	uint32_t fields[3] = { a, b, c };
+	uint32_t count = alloc_trace_fields(event);
+
+	/* The record must reach the serial line in one piece, without any other
+	   output landing in the middle of it. */
+	uintptr_t flags = irq_save();
+	putc_serial((char)ALLOC_TRACE_MARKER);
+	putc_serial((char)event);
+	for (uint32_t n = 0; n < count; ++n) {
+		__alloc_trace_field(fields[n]);
+	}
+	irq_restore(flags);
+}
+
+#endif
\ No newline at end of file
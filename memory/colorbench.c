@@ -0,0 +1,245 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <colorbench.h>
+#include <pmm.h>
+#include <vmm.h>
+#include <arch.h>
+#include <alloc.h>
+#include <time.h>
+#include <print.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+/* The working sets are read one cache line at a time. */
+#define COLORBENCH_LINE		64
+
+/* A scattered working set is picked at random from a pool of frames that is
+   this many times larger than the set. */
+#define COLORBENCH_SCATTER	4
+
+enum colorbench_set
+{
+	colorbench_contiguous,
+	colorbench_scattered,
+	colorbench_colored,
+	colorbench_same,
+	colorbench_set_count
+};
+
+static const char *colorbench_names[colorbench_set_count] = {
+	"contiguous", "scattered", "colored", "same color"
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static paddr_t colorbench_frame(enum colorbench_set set, uint32_t colors)
+{
+	switch (set) {
+		case colorbench_colored:
+			return pmm_acquire_colored_frame(PMM_COLOR_DIVERSE);
+
+		case colorbench_same: {
+			/* Take the first frame of an aligned block holding one frame of
+			   every color, so that it always has color 0, and return the
+			   rest of the block. */
+			uint32_t order = 0;
+			while ((1U << order) < colors) {
+				++order;
+			}
+
+			paddr_t block = pmm_acquire_frames(order, 0);
+			if (block != 0 && pmm_split_frames(block, order) == e_ok) {
+				for (uint32_t i = 1; i < (1U << order); ++i) {
+					pmm_release_frame(block + (i * FRAME_SIZE));
+				}
+			}
+			return block;
+		}
+
+		default:
+			return pmm_acquire_frame();
+	}
+}
+
+static uint32_t colorbench_scatter(paddr_t *frames, uint32_t pages)
+{
+	/* The frames of a system that has been running for a while are scattered
+	   across physical memory, and their colors have little to do with each
+	   other. This is imitated by picking the set at random from a larger pool
+	   of frames, and returning the rest of the pool. A fixed seed keeps the
+	   choice the same from one run to the next. */
+	uint32_t pool = pages * COLORBENCH_SCATTER;
+	paddr_t *all = kalloc(pool * sizeof(*all));
+	if (!all) {
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < pool; ++i) {
+		all[i] = pmm_acquire_frame();
+	}
+
+	uint32_t seed = 1;
+	for (uint32_t i = 0; i < pages; ++i) {
+		seed = (seed * 1103515245) + 12345;
+		uint32_t j = i + ((seed >> 8) % (pool - i));
+		frames[i] = all[j];
+		all[j] = all[i];
+	}
+
+	for (uint32_t i = pages; i < pool; ++i) {
+		pmm_release_frame(all[i]);
+	}
+	kfree(all);
+
+	return pages;
+}
+
+static uint32_t colorbench_acquire(
+	enum colorbench_set set, paddr_t *frames, uint32_t pages, uint32_t colors
+) {
+	if (set == colorbench_scattered) {
+		return colorbench_scatter(frames, pages);
+	}
+	else if (set == colorbench_contiguous) {
+		/* A single block, with any frames beyond the set returned. */
+		uint32_t order = 0;
+		while ((1U << order) < pages) {
+			++order;
+		}
+
+		paddr_t block = pmm_acquire_frames(order, 0);
+		if (block == 0 || pmm_split_frames(block, order) != e_ok) {
+			return 0;
+		}
+		for (uint32_t i = 0; i < (1U << order); ++i) {
+			if (i < pages) {
+				frames[i] = block + (i * FRAME_SIZE);
+			}
+			else {
+				pmm_release_frame(block + (i * FRAME_SIZE));
+			}
+		}
+		return pages;
+	}
+
+	uint32_t acquired = 0;
+	while (acquired < pages) {
+		paddr_t frame = colorbench_frame(set, colors);
+		if (frame == 0) {
+			break;
+		}
+		frames[acquired++] = frame;
+	}
+	return acquired;
+}
+
+static uint32_t colorbench_walk(
+	volatile uint32_t *base, uint32_t pages, uint32_t passes
+) {
+	uint32_t words = (pages * PAGE_SIZE) / sizeof(uint32_t);
+	uint32_t stride = COLORBENCH_LINE / sizeof(uint32_t);
+	uint32_t sum = 0;
+
+	/* The first pass brings as much of the working set into the cache as it
+	   can hold, and is not measured. Only the fastest of the remaining passes
+	   is kept, as it is the least disturbed by interrupts. */
+	uint32_t best = 0xFFFFFFFF;
+	for (uint32_t pass = 0; pass <= passes; ++pass) {
+		uint64_t start = cpu_ticks();
+		for (uint32_t i = 0; i < words; i += stride) {
+			sum += base[i];
+		}
+		uint64_t ticks = cpu_ticks() - start;
+
+		if (pass > 0 && ticks < best) {
+			best = (uint32_t)ticks;
+		}
+	}
+
+	(void)sum;
+	return best;
+}
+
+void colorbench_run(uint32_t pages, uint32_t passes)
+{
+	uint32_t colors = arch_cache_colors();
+	if (colors <= 1) {
+		kprint("The cache geometry is unknown, so frames are not colored.\n");
+		return;
+	}
+
+	/* Coloring is enabled for the duration of the benchmark, even if it is
+	   not otherwise used. */
+	uint32_t previous = pmm_frame_colors();
+	pmm_set_frame_colors(colors);
+	colors = pmm_frame_colors();
+
+	/* By default the working set fills most of the cache, which is where the
+	   colors of its frames matter most. */
+	if (pages == 0) {
+		pages = (colors * arch_cache_ways() * 7) / 8;
+	}
+	pages = MIN(pages, COLORBENCH_MAX_PAGES);
+	passes = (passes == 0) ? COLORBENCH_PASSES : passes;
+	kprint("colorbench: %d pages, %d passes, %d colors\n",
+		pages, passes, colors);
+
+	paddr_t *frames = kalloc(pages * sizeof(*frames));
+	for (uint32_t set = 0; frames && set < colorbench_set_count; ++set) {
+		uint32_t count[PMM_MAX_COLORS] = { 0 };
+		uint32_t distinct = 0;
+		uint32_t worst = 0;
+
+		uint32_t acquired = colorbench_acquire(set, frames, pages, colors);
+		for (uint32_t i = 0; i < acquired; ++i) {
+			uint32_t color = pmm_frame_color(frames[i]);
+			distinct += (count[color]++ == 0);
+			worst = MAX(worst, count[color]);
+		}
+
+		/* The mapping owns the frames once it has been attempted. */
+		uintptr_t linear = 0;
+		if (acquired == pages) {
+			linear = vmm_map_frames(frames, pages);
+		}
+		else {
+			while (acquired > 0) {
+				pmm_release_frame(frames[--acquired]);
+			}
+		}
+
+		if (linear == 0) {
+			kprint("%s: not enough memory\n", colorbench_names[set]);
+			continue;
+		}
+
+		uint32_t best = colorbench_walk((void *)linear, pages, passes);
+		vmm_release_any_pages(linear, pages);
+
+		kprint("%s: %d cycles per pass, %d colors (at most %d pages of one)\n",
+			colorbench_names[set], best, distinct, worst);
+	}
+
+	kfree(frames);
+	pmm_set_frame_colors(previous);
+}
\ No newline at end of file
@@ -25,6 +25,7 @@
 #include <vmm.h>
 #include <print.h>
 #include <panic.h>
+#include <string.h>
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -43,6 +44,101 @@ static inline uint32_t block_size(uint32_t alloc_size)
 	return heap_align(alloc_size + heap_align(sizeof(struct heap_block)));
 }
 
+/* A free block keeps its free list links in its data, so no block may be
+   smaller than the links. */
+#define HEAP_MIN_SIZE	sizeof(struct heap_links)
+
+/* The number of blocks of the request's own size class that are considered
+   before a block is taken from a larger class. */
+#define HEAP_FIT_SEARCH	8
+
+static inline struct heap_links *block_links(struct heap_block *block)
+{
+	return (struct heap_links *)block->start;
+}
+
+static inline uint32_t heap_size_class(uint32_t size)
+{
+	return 31 - __builtin_clz(size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void heap_link(struct heap *heap, struct heap_block *block)
+{
+	uint32_t class = heap_size_class(block->size);
+	struct heap_block *head = heap->free_lists[class];
+
+	block_links(block)->next = head;
+	block_links(block)->back = NULL;
+	if (head) {
+		block_links(head)->back = block;
+	}
+
+	heap->free_lists[class] = block;
+	heap->free_map |= (1U << class);
+}
+
+static void heap_unlink(struct heap *heap, struct heap_block *block)
+{
+	uint32_t class = heap_size_class(block->size);
+	struct heap_block *next = block_links(block)->next;
+	struct heap_block *back = block_links(block)->back;
+
+	if (back) {
+		block_links(back)->next = next;
+	}
+	else {
+		heap->free_lists[class] = next;
+	}
+
+	if (next) {
+		block_links(next)->back = back;
+	}
+
+	if (heap->free_lists[class] == NULL) {
+		heap->free_map &= ~(1U << class);
+	}
+}
+
+static struct heap_block *heap_find_free(struct heap *heap, uint32_t size)
+{
+	/* Blocks in the request's own class are less than twice its size, so any
+	   that fits is preferred to a block from a larger class. The closest fit
+	   among the first few blocks of the class is used, and an exact fit ends
+	   the search early. */
+	uint32_t class = heap_size_class(size);
+	struct heap_block *block = heap->free_lists[class];
+	struct heap_block *best = NULL;
+
+	for (uint32_t n = 0; block && n < HEAP_FIT_SEARCH; ++n) {
+		if (block->size >= size && (!best || block->size < best->size)) {
+			best = block;
+			if (best->size == size) {
+				break;
+			}
+		}
+		block = block_links(block)->next;
+	}
+
+	if (best) {
+		return best;
+	}
+
+	/* Every block in a higher class than the request is large enough, so the
+	   smallest non-empty higher class gives a block without searching. */
+	uint32_t larger = (class < 31) ? heap->free_map & (~0U << (class + 1)) : 0;
+	if (larger) {
+		return heap->free_lists[__builtin_ctz(larger)];
+	}
+
+	/* Only once nothing larger is free is the rest of the class searched. */
+	while (block && block->size < size) {
+		block = block_links(block)->next;
+	}
+	return block;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 oserr init_heap(struct heap **heap, uintptr_t base, uintptr_t limit)
@@ -66,6 +162,14 @@ oserr init_heap(struct heap **heap, uintptr_t base, uintptr_t limit)
 
 	/* TODO: Check proposed heap size. */
 
+	/* The heap manages every page in its range, so the range must never be
+	   handed out for anything else. Pages are acquired on demand, the first
+	   time they are accessed. */
+	if (vmm_create_region("heap", base, limit) != e_ok) {
+		klogc(serr, "Failed to reserve heap range %p:%p\n", base, limit);
+		return e_fail;
+	}
+
 	/* The heap will require the first page in itself to be allocated. This is
 	   so the initial data structures can be constructed (the heap manages its
 	   own memory). */
@@ -82,14 +186,26 @@ oserr init_heap(struct heap **heap, uintptr_t base, uintptr_t limit)
 	(*heap)->free_blocks = 1;
 	(*heap)->first = (void *)heap_align(base + sizeof(**heap));
 	(*heap)->last = (*heap)->first;
+	(*heap)->free_map = 0;
+	for (uint32_t i = 0; i < HEAP_FREE_CLASSES; ++i) {
+		(*heap)->free_lists[i] = NULL;
+	}
+	(*heap)->retained = 0;
+	(*heap)->retain_low = HEAP_RETAIN_LOW;
+	(*heap)->retain_high = HEAP_RETAIN_HIGH;
+	(*heap)->trims = 0;
+	(*heap)->trimmed = 0;
+	spin_init(&(*heap)->lock);
 
 
 	/* Setup the first block. */
 	(*heap)->first->state = heap_block_free;
 	(*heap)->first->size = (limit - block_start((*heap)->first));
+	(*heap)->first->start = block_start((*heap)->first);
 	(*heap)->first->owner = *heap;
 	(*heap)->first->next = NULL;
 	(*heap)->first->back = NULL;
+	heap_link(*heap, (*heap)->first);
 
 	/* Heap setup and constructed successfully. */
 	return e_ok;
@@ -121,72 +237,105 @@ static void __debug_dump_heap(struct heap *heap)
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static oserr heap_map_page(uintptr_t addr)
-{
-	if (vmm_acquire_page(addr) != e_ok) {
-		panic(
-			"Heap Allocation Failure",
-			"The heap has been unable to correctly acquire memory for "
-			"an allocation."
-		);
-	}
-	return e_ok;
-}
-
 static oserr heap_unmap_page(uintptr_t addr)
 {
 	return vmm_release_page(addr);
 }
 
-static oserr heap_map_pages(struct heap_block *block)
-{
-	uintptr_t base = (uintptr_t)block;
-	uintptr_t limit = block_start(block) + block->size;
-	for (uintptr_t addr = base; addr < limit; addr += FRAME_SIZE) {
-		(void)heap_map_page(addr); /* Ignore result - handled above. */
-	}
-	return e_ok;
-}
-
-static oserr heap_unmap_pages(struct heap_block *block)
-{
-	if (block == NULL) {
-		klogc(swarn, "Attempted to unmap pages for a NULL block.\n");
-		return e_ok;
-	}
-
+static void heap_page_range(
+	struct heap_block *block, uintptr_t *base, uintptr_t *limit
+) {
 	/* If the block is the last one in the heap, then we need to act slightly
 	   differently. */
-	uintptr_t base = block->start;
-	uintptr_t limit = 0;
 	if (block->next == NULL) {
 		/* We need to validate that the upper limit of the heap is page
 		   aligned, otherwise we're in danger of potential corruption. */
-		limit = block->start + block->size;
-		if (limit & (FRAME_SIZE - 1)) {
+		*limit = block->start + block->size;
+		if (*limit & (FRAME_SIZE - 1)) {
 			/* The end of the heap is not aligned. */
 			klogc(swarn, "Heap %p was not correctly aligned!\n", block->owner);
-			limit &= ~(FRAME_SIZE - 1);
+			*limit &= ~(FRAME_SIZE - 1);
 		}
 	}
 	else {
 		/* Get the start of the next block, and page align down. */
-		limit = ((uintptr_t)block->next) & ~(FRAME_SIZE - 1);
+		*limit = ((uintptr_t)block->next) & ~(FRAME_SIZE - 1);
 	}
 
 	/* We also need to find the actual start. If something else before the block
-	   is also using the page, we must not unmap it. */
-	if (block->start & (FRAME_SIZE - 1)) {
+	   is also using the page, we must not unmap it. The page holding the free
+	   list links at the start of the block must also be kept. */
+	*base = block->start + sizeof(struct heap_links);
+	if (*base & (FRAME_SIZE - 1)) {
 		/* The block is not aligned to the start of the page. */
-		base = (block->start + FRAME_SIZE) & ~(FRAME_SIZE - 1);
+		*base = (*base + FRAME_SIZE) & ~(FRAME_SIZE - 1);
+	}
+}
+
+static uint32_t heap_unmap_pages(struct heap_block *block)
+{
+	if (block == NULL) {
+		klogc(swarn, "Attempted to unmap pages for a NULL block.\n");
+		return 0;
 	}
 
+	uintptr_t base, limit;
+	heap_page_range(block, &base, &limit);
+
 	/* We're ready to actually unmap the pages now. */
-	if (limit > base) {
+	uint32_t count = (limit > base) ? vmm_count_acquired(base, limit) : 0;
+	if (count) {
 		vmm_release_pages(base, limit);
 	}
+	return count;
+}
 
-	return e_ok;
+static void heap_trim_pages(struct heap *heap, uint32_t target)
+{
+	/* Larger free blocks are the least likely to be reused soon, and release
+	   the most pages, so they are trimmed first. */
+	heap->trims++;
+	for (int32_t class = HEAP_FREE_CLASSES - 1; class >= 0; --class) {
+		struct heap_block *block = heap->free_lists[class];
+		for (; block; block = block_links(block)->next) {
+			uint32_t count = heap_unmap_pages(block);
+			heap->trimmed += count;
+			heap->retained -= (count < heap->retained) ? count : heap->retained;
+			if (heap->retained <= target) {
+				return;
+			}
+		}
+	}
+
+	/* Every free block has been trimmed, so nothing is retained. */
+	heap->retained = 0;
+}
+
+static void heap_retain_pages(
+	struct heap *heap, uintptr_t first, uintptr_t last
+) {
+	/* Pages that become part of a free block are kept, rather than being
+	   released straight away, so that they can be reused without faulting
+	   them back in. Once too many are held, they are trimmed back. */
+	if (last > first) {
+		heap->retained += vmm_count_acquired(first, last);
+	}
+
+	if (heap->retained > heap->retain_high) {
+		heap_trim_pages(heap, heap->retain_low);
+	}
+}
+
+static void heap_claim_pages(
+	struct heap *heap, uintptr_t first, uintptr_t last
+) {
+	/* Only whole pages of an allocation were counted as retained. */
+	first = (first + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+	last &= ~(FRAME_SIZE - 1);
+	if (last > first && heap->retained) {
+		uint32_t count = vmm_count_acquired(first, last);
+		heap->retained -= (count < heap->retained) ? count : heap->retained;
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -218,6 +367,7 @@ static void *heap_merge_blocks(struct heap_block *b0, struct heap_block *b1)
 		   straight forward. */
 		b0->next = NULL;
 		b0->size += heap_align(sizeof(*b1)) + b1->size;
+		b1->owner->last = b0;
 	}
 
 	/* Update the start pointer */
@@ -229,116 +379,432 @@ static void *heap_merge_blocks(struct heap_block *b0, struct heap_block *b1)
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void *heap_alloc(struct heap *heap, uint32_t size)
+static inline uint32_t heap_request_size(uint32_t size)
 {
-	/* Search through the blocks in the heap for a suitable block to use for the
-	   requested allocation. When a block is found, it will be divided into
-	   2 blocks (if large enough), one being a "free" block and the other
-	   being used for the allocation. */
-	if (!heap) {
-		klogc(swarn, "Bad allocation attempt on NULL heap.\n");
-		return NULL;
-	}
-
-	uint32_t req_block_size = block_size(size);
-
-	struct heap_block *ptr = heap->first;
-	do {
-		if (ptr->state == heap_block_free) {
-
-			/* Is the block large enough to get an allocation out of? */
-			if (ptr->size >= req_block_size) {
-				/* We can make a division. First record some of the existing
-				   information so that we can update the block list afterward */
-				uint32_t orig_size = ptr->size;
-				struct heap_block *next = ptr->next;
-
-				/* Allocate this block first */
-				ptr->state = heap_block_used;
-				ptr->size = heap_align(size);
-				ptr->start = block_start(ptr);
-				ptr->next = (void *)(ptr->start + ptr->size);
-
-				/* Setup the new block */
-				heap_map_page((uintptr_t)ptr->next);
-				ptr->next->state = heap_block_free;
-				ptr->next->next = next;
-				ptr->next->back = ptr;
-				ptr->next->size = orig_size - (
-					(uintptr_t)ptr->next - (uintptr_t)ptr
-				);
-				ptr->next->owner = heap;
-				next->back = ptr->next;
-
-				/* Make sure the required pages are mapped. */
-				heap_map_pages(ptr);
-
-				/* Update the heap. We now have more blocks in the heap.
-				   However the free block count stays the same. */
-				heap->block_count++;
-
-				/* Return the new block */
-				return (void *)ptr->start;
-			}
-			else if (ptr->size >= size) {
-				/* We can use the block, but make sure it is valid. */
-				ptr->state = heap_block_used;
-				ptr->start = block_start(ptr);
-				heap->free_blocks--;
-				heap_map_pages(ptr);
-				return (void *)ptr->start;
-			}
-
-		}
-	} while ((ptr = ptr->next) != NULL);
-
-	/* Reaching this point indicates that we failed to find anything. Return
-	   NULL to indicate a failed allocation. */
-	return NULL;
+	/* Every block must be able to hold the free list links once released. */
+	size = heap_align(size);
+	return (size < HEAP_MIN_SIZE) ? HEAP_MIN_SIZE : size;
 }
 
-void heap_dealloc(struct heap *heap, void *ptr)
+static struct heap_block *heap_used_block(struct heap *heap, void *ptr)
 {
 	uint32_t block_header_size = heap_align(sizeof(struct heap_block));
 
 	if (ptr == NULL) {
 		klogc(swarn, "Attempted to deallocate NULL.\n");
-		return;
+		return NULL;
 	}
-	else if (ptr < heap->base + block_header_size) {
+	else if ((uintptr_t)ptr < heap->base + block_header_size) {
 		klogc(swarn, "Attempt to deallocate an invalid pointer %p!\n", ptr);
 		__debug_dump_heap(heap);
-		return;
+		return NULL;
 	}
 
-
-	/* Determine the actual block structure for the provided pointer. */
-	struct heap_block *block = (uintptr_t)ptr - block_header_size;
-	/* Validate that this is the required block. TODO this, check that
-	   the owner is the specified heap and that it has a valid start. */
-	if (block->owner != heap || block->start != (uintptr_t)ptr) {
+	/* Determine the actual block structure for the provided pointer, and
+	   validate that the block is an allocation of the specified heap. */
+	struct heap_block *block = (void *)((uintptr_t)ptr - block_header_size);
+	if (
+		block->owner != heap || block->start != (uintptr_t)ptr ||
+		block->state != heap_block_used
+	) {
 		/* Invalid deallocation attempted. Warn and ignore. */
 		klogc(swarn, "Attempted to perform invalid deallocation %p.\n", ptr);
+		return NULL;
+	}
+
+	return block;
+}
+
+static struct heap_block *heap_take_block(
+	struct heap *heap, struct heap_block *block
+) {
+	heap_unlink(heap, block);
+	block->state = heap_block_used;
+	heap->free_blocks--;
+	return block;
+}
+
+static void heap_split_block(
+	struct heap *heap, struct heap_block *block, uint32_t size
+) {
+	/* Is the block large enough to divide into the allocation and a new free
+	   block? If not, the whole block is used for the allocation. */
+	if (block->size < block_size(size) + HEAP_MIN_SIZE) {
 		return;
 	}
 
-	/* Mark the block as free, and try to collect neighbouring blocks. */
+	/* We can make a division. First record some of the existing information
+	   so that we can update the block list afterward */
+	uint32_t orig_size = block->size;
+	struct heap_block *next = block->next;
+
+	/* Allocate this block first */
+	block->size = size;
+	block->next = (void *)(block->start + block->size);
+
+	/* Setup the new block. Any page that it occupies is acquired as soon as it
+	   is touched. */
+	struct heap_block *rest = block->next;
+	rest->state = heap_block_free;
+	rest->next = next;
+	rest->back = block;
+	rest->size = orig_size - ((uintptr_t)rest - (uintptr_t)block);
+	rest->start = block_start(rest);
+	rest->owner = heap;
+	if (next) {
+		next->back = rest;
+	}
+	else {
+		heap->last = rest;
+	}
+
+	/* Update the heap. We now have more blocks in the heap. */
+	heap->block_count++;
+	heap->free_blocks++;
+
+	/* When a block shrinks, the block following it may already be free. */
+	if (next && next->state == heap_block_free) {
+		heap_unlink(heap, next);
+		heap_merge_blocks(rest, next);
+		heap->block_count--;
+		heap->free_blocks--;
+	}
+
+	heap_link(heap, rest);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void *heap_alloc_block(struct heap *heap, uint32_t size)
+{
+	/* Take a suitable block for the requested allocation from the free lists,
+	   without visiting any used blocks. When a block is found, it will be
+	   divided into 2 blocks (if large enough), one being a "free" block and
+	   the other being used for the allocation. */
+	size = heap_request_size(size);
+	struct heap_block *ptr = heap_find_free(heap, size);
+	if (ptr == NULL) {
+		/* Reaching this point indicates that we failed to find anything.
+		   Return NULL to indicate a failed allocation. */
+		return NULL;
+	}
+
+	heap_take_block(heap, ptr);
+	heap_split_block(heap, ptr, size);
+	heap_claim_pages(heap, ptr->start, ptr->start + ptr->size);
+	return (void *)ptr->start;
+}
+
+static void heap_free_block(struct heap *heap, struct heap_block *block)
+{
+	/* Mark the block as free, and try to collect neighbouring blocks. Any
+	   neighbour that is merged leaves its free list first, as its size is
+	   about to change. */
 	block->state = heap_block_free;
+	heap->free_blocks++;
 
-	/* TODO: Merging blocks together */
 	struct heap_block *next = block->next;
 	struct heap_block *back = block->back;
 
+	/* The pages of a free neighbour are already accounted for, so only the
+	   pages between them become newly retained. */
+	uintptr_t first = 0, last = ~(uintptr_t)0, unused;
+	if (back && back->state == heap_block_free) {
+		heap_page_range(back, &unused, &first);
+	}
+	if (next && next->state == heap_block_free) {
+		heap_page_range(next, &last, &unused);
+	}
+
 	if (back && back->state == heap_block_free) {
 		/* Merge block into back */
+		heap_unlink(heap, back);
 		block = heap_merge_blocks(back, block);
+		heap->block_count--;
+		heap->free_blocks--;
 	}
 
 	if (next && next->state == heap_block_free) {
 		/* Merge next into block */
+		heap_unlink(heap, next);
 		block = heap_merge_blocks(block, next);
+		heap->block_count--;
+		heap->free_blocks--;
 	}
 
-	/* Check the entire range of the block's memory. Can we unmap any pages? */
-	heap_unmap_pages(block);
+	heap_link(heap, block);
+
+	/* Check the entire range of the block's memory. The pages that can be
+	   unmapped are retained for now, and trimmed once too many are held. */
+	uintptr_t base, limit;
+	heap_page_range(block, &base, &limit);
+	heap_retain_pages(
+		heap, (first > base) ? first : base, (last < limit) ? last : limit
+	);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void *heap_alloc(struct heap *heap, uint32_t size)
+{
+	if (!heap) {
+		klogc(swarn, "Bad allocation attempt on NULL heap.\n");
+		return NULL;
+	}
+
+	spin_lock(&heap->lock);
+	void *ptr = heap_alloc_block(heap, size);
+	spin_unlock(&heap->lock);
+	return ptr;
+}
+
+uint32_t heap_alloc_batch(
+	struct heap *heap, uint32_t size, void **objects, uint32_t count
+) {
+	if (!heap) {
+		klogc(swarn, "Bad allocation attempt on NULL heap.\n");
+		return 0;
+	}
+
+	uint32_t n = 0;
+	spin_lock(&heap->lock);
+	while (n < count && (objects[n] = heap_alloc_block(heap, size)) != NULL) {
+		++n;
+	}
+	spin_unlock(&heap->lock);
+	return n;
+}
+
+void *heap_alloc_aligned(struct heap *heap, uint32_t size, uint32_t align)
+{
+	if (!heap) {
+		klogc(swarn, "Bad allocation attempt on NULL heap.\n");
+		return NULL;
+	}
+	else if (align & (align - 1)) {
+		klogc(swarn, "Bad allocation alignment %d.\n", align);
+		return NULL;
+	}
+	else if (align <= sizeof(uint32_t)) {
+		return heap_alloc(heap, size);
+	}
+
+	/* The aligned start may need to be moved far enough into the block to
+	   leave a free block in front of it. Asking for enough space to cover
+	   that in the worst case means any block that is found is suitable. */
+	uint32_t header_size = heap_align(sizeof(struct heap_block));
+	uint32_t lead = header_size + HEAP_MIN_SIZE;
+	size = heap_request_size(size);
+	spin_lock(&heap->lock);
+	struct heap_block *ptr = heap_find_free(heap, size + lead + align);
+	if (ptr == NULL) {
+		spin_unlock(&heap->lock);
+		return NULL;
+	}
+
+	heap_take_block(heap, ptr);
+
+	uintptr_t start = (ptr->start + align - 1) & ~(uintptr_t)(align - 1);
+	if (start != ptr->start) {
+		/* Place a new block so that its data is aligned, and return the space
+		   in front of it to the free lists. */
+		start = (ptr->start + lead + align - 1) & ~(uintptr_t)(align - 1);
+		struct heap_block *block = (void *)(start - header_size);
+		block->state = heap_block_used;
+		block->size = (ptr->start + ptr->size) - start;
+		block->start = start;
+		block->owner = heap;
+		block->back = ptr;
+		block->next = ptr->next;
+		if (block->next) {
+			block->next->back = block;
+		}
+		else {
+			heap->last = block;
+		}
+
+		ptr->state = heap_block_free;
+		ptr->size = (uintptr_t)block - ptr->start;
+		ptr->next = block;
+		heap_link(heap, ptr);
+		heap->block_count++;
+		heap->free_blocks++;
+		ptr = block;
+	}
+
+	heap_split_block(heap, ptr, size);
+	heap_claim_pages(heap, ptr->start, ptr->start + ptr->size);
+	spin_unlock(&heap->lock);
+	return (void *)ptr->start;
+}
+
+void *heap_calloc(struct heap *heap, uint32_t count, uint32_t size)
+{
+	if (size && count > (uint32_t)~0 / size) {
+		klogc(swarn, "Allocation of %d objects of %d bytes overflows.\n",
+			count, size);
+		return NULL;
+	}
+
+	uintptr_t ptr = (uintptr_t)heap_alloc(heap, count * size);
+	if (!ptr) {
+		return NULL;
+	}
+
+	/* Pages of the heap that have never been written to will be zero filled
+	   when they are first accessed, so only pages that have been used before
+	   need to be cleared. */
+	uintptr_t limit = ptr + (count * size);
+	for (uintptr_t addr = ptr; addr < limit; ) {
+		uintptr_t next = (addr & ~(FRAME_SIZE - 1)) + FRAME_SIZE;
+		if (next > limit) {
+			next = limit;
+		}
+		if (!vmm_page_is_zero(addr)) {
+			memset((void *)addr, 0, next - addr);
+		}
+		addr = next;
+	}
+
+	return (void *)ptr;
+}
+
+void *heap_realloc(struct heap *heap, void *ptr, uint32_t size)
+{
+	if (ptr == NULL) {
+		return heap_alloc(heap, size);
+	}
+	else if (size == 0) {
+		heap_dealloc(heap, ptr);
+		return NULL;
+	}
+
+	spin_lock(&heap->lock);
+	struct heap_block *block = heap_used_block(heap, ptr);
+	if (!block) {
+		spin_unlock(&heap->lock);
+		return NULL;
+	}
+
+	/* Attempt to grow the block in place, by taking in the block that follows
+	   it if that block is free and large enough. */
+	uint32_t request = heap_request_size(size);
+	uint32_t header_size = heap_align(sizeof(struct heap_block));
+	uintptr_t end = block->start + block->size;
+	struct heap_block *next = block->next;
+	if (request > block->size && next && next->state == heap_block_free
+		&& block->size + header_size + next->size >= request
+	) {
+		heap_take_block(heap, next);
+		heap_merge_blocks(block, next);
+		heap->block_count--;
+	}
+
+	/* If the block is now large enough, then any excess is returned to the
+	   heap. Otherwise the allocation has to move. */
+	if (request <= block->size) {
+		heap_split_block(heap, block, request);
+		uintptr_t limit = block->start + block->size;
+		if (limit > end) {
+			heap_claim_pages(heap, end, limit);
+		}
+		else if (limit < end && block->next->state == heap_block_free) {
+			uintptr_t first = block->next->start + sizeof(struct heap_links);
+			first = (first + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+			heap_retain_pages(heap, first, end & ~(FRAME_SIZE - 1));
+		}
+		spin_unlock(&heap->lock);
+		return ptr;
+	}
+	spin_unlock(&heap->lock);
+
+	/* The block is still owned by the caller, so its contents can be copied
+	   without holding the lock. */
+	void *moved = heap_alloc(heap, size);
+	if (moved) {
+		memcpy(moved, ptr, block->size);
+		heap_dealloc(heap, ptr);
+	}
+	return moved;
+}
+
+void heap_dealloc(struct heap *heap, void *ptr)
+{
+	spin_lock(&heap->lock);
+	struct heap_block *block = heap_used_block(heap, ptr);
+	if (block) {
+		heap_free_block(heap, block);
+	}
+	spin_unlock(&heap->lock);
+}
+
+void heap_dealloc_batch(struct heap *heap, void **objects, uint32_t count)
+{
+	spin_lock(&heap->lock);
+	for (uint32_t i = 0; i < count; ++i) {
+		struct heap_block *block = heap_used_block(heap, objects[i]);
+		if (block) {
+			heap_free_block(heap, block);
+		}
+	}
+	spin_unlock(&heap->lock);
+}
+
+uint32_t heap_alloc_size(struct heap *heap, void *ptr)
+{
+	/* The header of an allocation only changes through its owner, so it can
+	   be read without holding the lock. */
+	struct heap_block *block = heap_used_block(heap, ptr);
+	return block ? block->size : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void heap_trim(struct heap *heap, uint32_t target)
+{
+	if (!heap) {
+		klogc(swarn, "Attempted to trim a NULL heap.\n");
+		return;
+	}
+
+	spin_lock(&heap->lock);
+	heap_trim_pages(heap, target);
+	spin_unlock(&heap->lock);
+}
+
+uint32_t heap_shrink(struct heap *heap, uint32_t count)
+{
+	/* Memory can be reclaimed whilst the heap's lock is held by the very
+	   thread that needs it, so the lock is never waited for. */
+	if (!heap || !spin_trylock(&heap->lock)) {
+		return 0;
+	}
+
+	uint32_t trimmed = heap->trimmed;
+	if (heap->retained) {
+		heap_trim_pages(
+			heap, (heap->retained > count) ? heap->retained - count : 0
+		);
+	}
+	trimmed = heap->trimmed - trimmed;
+
+	spin_unlock(&heap->lock);
+	return trimmed;
+}
+
+oserr heap_set_retention(struct heap *heap, uint32_t low, uint32_t high)
+{
+	if (!heap || low > high) {
+		klogc(swarn, "Invalid heap retention %d:%d.\n", low, high);
+		return e_fail;
+	}
+
+	spin_lock(&heap->lock);
+	heap->retain_low = low;
+	heap->retain_high = high;
+	if (heap->retained > high) {
+		heap_trim_pages(heap, low);
+	}
+	spin_unlock(&heap->lock);
+	return e_ok;
 }
\ No newline at end of file
@@ -0,0 +1,235 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#if defined(HEAP_PROFILE)
+
+#include <heapprof.h>
+#include <print.h>
+#include <lock.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+/* Live allocations, keyed by address, recording the site that made them. An
+   entry with a ptr of 0 is empty. */
+struct heapprof_tracked
+{
+	uintptr_t ptr;
+	uint32_t size;
+	struct heapprof_site *site;
+};
+
+static struct {
+	struct spinlock lock;
+	struct heapprof_site sites[HEAPPROF_MAX_SITES];
+	struct heapprof_tracked tracked[HEAPPROF_MAX_TRACKED];
+	uint32_t site_count;
+	uint32_t tracked_count;
+	uint32_t untracked;
+} profile;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t __heapprof_hash(uintptr_t value, uint32_t count)
+{
+	return ((value >> 2) * 2654435761U) % count;
+}
+
+static inline uint32_t __heapprof_bucket(uint32_t size)
+{
+	uint32_t bucket = 0;
+	while (bucket < HEAPPROF_BUCKETS - 1
+		&& size >= (1U << (bucket + HEAPPROF_MIN_SHIFT))
+	) {
+		++bucket;
+	}
+	return bucket;
+}
+
+static struct heapprof_site *__heapprof_find_site(uintptr_t site)
+{
+	uint32_t i = __heapprof_hash(site, HEAPPROF_MAX_SITES);
+	for (uint32_t n = 0; n < HEAPPROF_MAX_SITES; ++n) {
+		struct heapprof_site *entry = &profile.sites[i];
+		if (entry->site == site) {
+			return entry;
+		}
+		else if (entry->site == 0) {
+			/* The site has not been seen before. */
+			if (profile.site_count >= HEAPPROF_MAX_SITES - 1) {
+				return NULL;
+			}
+			profile.site_count++;
+			entry->site = site;
+			return entry;
+		}
+		i = (i + 1) % HEAPPROF_MAX_SITES;
+	}
+	return NULL;
+}
+
+static struct heapprof_tracked *__heapprof_find_tracked(uintptr_t ptr)
+{
+	uint32_t i = __heapprof_hash(ptr, HEAPPROF_MAX_TRACKED);
+	while (profile.tracked[i].ptr != 0) {
+		if (profile.tracked[i].ptr == ptr) {
+			return &profile.tracked[i];
+		}
+		i = (i + 1) % HEAPPROF_MAX_TRACKED;
+	}
+	return NULL;
+}
+
+static void __heapprof_untrack(struct heapprof_tracked *entry)
+{
+	/* Entries that follow the removed one in the same run are shifted back,
+	   so that no lookup ever stops early at the hole. */
+	uint32_t hole = entry - profile.tracked;
+	uint32_t i = hole;
+	for (;;) {
+		i = (i + 1) % HEAPPROF_MAX_TRACKED;
+		if (profile.tracked[i].ptr == 0) {
+			break;
+		}
+
+		uint32_t home = __heapprof_hash(
+			profile.tracked[i].ptr, HEAPPROF_MAX_TRACKED
+		);
+		uint32_t distance = (i - home) % HEAPPROF_MAX_TRACKED;
+		uint32_t gap = (i - hole) % HEAPPROF_MAX_TRACKED;
+		if (distance >= gap) {
+			profile.tracked[hole] = profile.tracked[i];
+			hole = i;
+		}
+	}
+
+	profile.tracked[hole].ptr = 0;
+	profile.tracked_count--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void __heapprof_alloc(uintptr_t site, void *ptr, uint32_t size)
+{
+	if (!ptr) {
+		return;
+	}
+
+	/* The table is never filled completely, so that a lookup always reaches
+	   an empty entry. Allocations that can not be recorded are only counted,
+	   as their frees could not be attributed. */
+	spin_lock(&profile.lock);
+	struct heapprof_site *entry = __heapprof_find_site(site);
+	if (!entry || profile.tracked_count >= HEAPPROF_MAX_TRACKED - 1) {
+		profile.untracked++;
+		spin_unlock(&profile.lock);
+		return;
+	}
+
+	uint32_t i = __heapprof_hash((uintptr_t)ptr, HEAPPROF_MAX_TRACKED);
+	while (profile.tracked[i].ptr != 0) {
+		i = (i + 1) % HEAPPROF_MAX_TRACKED;
+	}
+	profile.tracked[i].ptr = (uintptr_t)ptr;
+	profile.tracked[i].size = size;
+	profile.tracked[i].site = entry;
+	profile.tracked_count++;
+
+	entry->allocs++;
+	entry->live_bytes += size;
+	if (entry->live_bytes > entry->peak_bytes) {
+		entry->peak_bytes = entry->live_bytes;
+	}
+	entry->histogram[__heapprof_bucket(size)]++;
+	spin_unlock(&profile.lock);
+}
+
+void __heapprof_free(void *ptr)
+{
+	spin_lock(&profile.lock);
+	struct heapprof_tracked *tracked = __heapprof_find_tracked((uintptr_t)ptr);
+	if (tracked) {
+		tracked->site->frees++;
+		tracked->site->live_bytes -= tracked->size;
+		__heapprof_untrack(tracked);
+	}
+	spin_unlock(&profile.lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void __heapprof_report(void)
+{
+	kprint("%d call sites, %d live allocations, %d untracked\n",
+		profile.site_count, profile.tracked_count, profile.untracked);
+
+	for (uint32_t i = 0; i < HEAPPROF_MAX_SITES; ++i) {
+		struct heapprof_site *site = &profile.sites[i];
+		if (site->site == 0) {
+			continue;
+		}
+
+		kprint("%p: %d allocs, %d frees, %d live bytes (peak %d)\n",
+			site->site, site->allocs, site->frees, site->live_bytes,
+			site->peak_bytes);
+		for (uint32_t n = 0; n < HEAPPROF_BUCKETS; ++n) {
+			if (site->histogram[n] == 0) {
+				continue;
+			}
+			else if (n == HEAPPROF_BUCKETS - 1) {
+				kprint("    >= %d bytes: %d\n",
+					1U << (n + HEAPPROF_MIN_SHIFT - 1), site->histogram[n]);
+			}
+			else {
+				kprint("    < %d bytes: %d\n",
+					1U << (n + HEAPPROF_MIN_SHIFT), site->histogram[n]);
+			}
+		}
+	}
+}
+
+void __heapprof_dump(void)
+{
+	/* One record per line, so that the output can be picked out of the rest
+	   of the serial log and the sites resolved against the kernel image. */
+	klog("heapprof begin sites=%d live=%d untracked=%d buckets=%d\n",
+		profile.site_count, profile.tracked_count, profile.untracked,
+		HEAPPROF_BUCKETS);
+
+	for (uint32_t i = 0; i < HEAPPROF_MAX_SITES; ++i) {
+		struct heapprof_site *site = &profile.sites[i];
+		if (site->site == 0) {
+			continue;
+		}
+
+		klog("heapprof site=%p allocs=%d frees=%d live=%d peak=%d hist=",
+			site->site, site->allocs, site->frees, site->live_bytes,
+			site->peak_bytes);
+		for (uint32_t n = 0; n < HEAPPROF_BUCKETS; ++n) {
+			klog((n == 0) ? "%d" : ",%d", site->histogram[n]);
+		}
+		klog("\n");
+	}
+
+	klog("heapprof end\n");
+}
+
+#endif
\ No newline at end of file
@@ -23,43 +23,396 @@
 #include <pmm.h>
 #include <panic.h>
 #include <print.h>
+#include <string.h>
+#include <time.h>
 #include <multiboot.h>
+#include <reclaim.h>
 
 ////////////////////////////////////////////////////////////////////////////////
 
 extern void *kernel_start;
 extern void *kernel_end;
 
+/* The frame table lives in wired memory directly after the kernel modules. It
+   is accessed through its physical address until paging has been enabled, at
+   which point the paging code maps it elsewhere and relocates it. The table is
+   able to describe up to 64GiB of physical memory. */
+#define PMM_MAX_FRAMES		0x01000000
+
+/* Frames beyond 4GiB can only be used once physical address extensions have
+   been enabled by the paging code. */
+#define PMM_LOW_FRAMES		0x00100000
+
+/* Single frames are served from a small cache rather than the buddy lists. The
+   cache is refilled from, and drained back into, the buddy lists in batches. */
+#define PMM_CACHE_SIZE		256
+#define PMM_CACHE_ORDER		5
+#define PMM_CACHE_BATCH		(1 << PMM_CACHE_ORDER)
+
+#define PMM_NO_FRAME		0xFFFFFFFF
+
+/* Available memory is only handed to the buddy lists on demand, one window of
+   the largest block order at a time. Frame table entries are initialised at
+   the same point, so boot time does not depend on the amount of memory. */
+#define PMM_WINDOW_FRAMES	(1 << PMM_MAX_ORDER)
+#define PMM_MAX_WINDOWS		(PMM_MAX_FRAMES / PMM_WINDOW_FRAMES)
+#define PMM_MAX_SPANS		32
+
 struct pmm_range
 {
 	uintptr_t start;
 	uintptr_t end;
 };
 
+/**
+ A span of available frames, recorded from the multiboot memory map, that has
+ not yet been given to the buddy lists.
+ */
+struct pmm_span
+{
+	uint32_t pfn;
+	uint32_t end;
+};
+
+/**
+ Possible states of an entry in the frame table.
+ 	- pmm_reserved	The frame is not managed by the allocator.
+ 	- pmm_free		The frame is the head of a free block in the buddy lists.
+ 	- pmm_used		The frame is the head of a block that has been acquired.
+ 	- pmm_cached	The frame is held in the single frame cache.
+ */
+enum pmm_state
+{
+	pmm_reserved = 0,
+	pmm_free,
+	pmm_used,
+	pmm_cached,
+};
+
+/**
+ Frame table entry. There is one of these for every frame of physical memory.
+ The allocator state is only meaningful for the first frame of a block, and the
+ links are only used whilst the block is on one of the buddy free lists. The
+ purpose and reference count are maintained for every frame.
+ */
+struct pmm_block
+{
+	uint32_t next;
+	uint32_t prev;
+	uint8_t order:4;
+	uint8_t state:4;
+	union frame frame;
+	uint16_t refs;
+};
+
+_Static_assert(
+	sizeof(struct pmm_block) == 12, "Incorrect struct pmm_block size."
+);
+
 static struct 
 {
 	struct {
 		uint32_t count;
-		struct {
-			uintptr_t *ptr;
-			uintptr_t *base;
-			uint32_t frames;
-			uint32_t available;
-			uintptr_t end;
-		} stack;
+		uint32_t available;
+		uint32_t purposes[frame_purpose_count];
+		struct pmm_block *table;
 	} frames;
+	struct {
+		uint32_t head[PMM_MAX_ORDER + 1];
+		uint32_t count[PMM_MAX_ORDER + 1];
+	} buddy;
+	struct {
+		uint32_t frames[PMM_CACHE_SIZE];
+		uint32_t count;
+	} cache;
+	struct {
+		uint32_t count;
+		uint32_t order;
+		uint32_t next;
+		uint32_t held;
+		uint32_t hits;
+		uint32_t misses;
+		uint32_t head[PMM_MAX_COLORS];
+	} colors;
+	struct {
+		struct pmm_span list[PMM_MAX_SPANS];
+		uint32_t count;
+		uint32_t limit;
+		uint32_t high;
+		uint32_t next;
+		uint32_t carved;
+		uint32_t windows[PMM_MAX_WINDOWS / 32];
+	} spans;
 	struct pmm_range kernel_code;
 	struct pmm_range kernel_mods;
 	struct pmm_range kernel_reserved;
 	struct pmm_range bios;
 } pmm;
 
-static void pmm_record_frame(uintptr_t frame);
+static void pmm_record_range(uint64_t start, uint64_t end);
+static bool pmm_carve(void);
+static enum frame_purpose pmm_range_purpose(paddr_t frame);
+static void pmm_use_spans(uint32_t limit);
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t pmm_pfn(paddr_t frame)
+{
+	return (uint32_t)(frame >> FRAME_SHIFT);
+}
+
+static inline paddr_t pmm_address(uint32_t pfn)
+{
+	return (paddr_t)pfn << FRAME_SHIFT;
+}
+
+static inline bool pmm_window_ready(uint32_t pfn)
+{
+	uint32_t window = pfn / PMM_WINDOW_FRAMES;
+	return (pmm.spans.windows[window >> 5] & (1 << (window & 0x1F))) != 0;
+}
+
+static inline bool pmm_frame_valid(uint32_t pfn)
+{
+	return (pfn < pmm.frames.count) && pmm_window_ready(pfn);
+}
+
+static inline void pmm_set_purpose(uint32_t pfn, enum frame_purpose purpose)
+{
+	struct pmm_block *block = &pmm.frames.table[pfn];
+	pmm.frames.purposes[block->frame.s.purpose]--;
+	pmm.frames.purposes[purpose]++;
+	block->frame.s.purpose = purpose;
+}
+
+static void pmm_claim(uint32_t pfn, uint32_t count)
+{
+	/* Frames that have just been acquired are assumed to be for the use of a
+	   context, until told otherwise. */
+	for (uint32_t i = 0; i < count; ++i) {
+		pmm_set_purpose(pfn + i, frame_context);
+		pmm.frames.table[pfn + i].frame.s.flags = 0;
+		pmm.frames.table[pfn + i].refs = 1;
+	}
+}
+
+static void pmm_unclaim(uint32_t pfn, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; ++i) {
+		pmm_set_purpose(pfn + i, frame_available);
+		pmm.frames.table[pfn + i].refs = 0;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void buddy_push(uint32_t pfn, uint32_t order)
+{
+	struct pmm_block *block = &pmm.frames.table[pfn];
+	uint32_t head = pmm.buddy.head[order];
+
+	block->state = pmm_free;
+	block->order = order;
+	block->prev = PMM_NO_FRAME;
+	block->next = head;
+
+	if (head != PMM_NO_FRAME) {
+		pmm.frames.table[head].prev = pfn;
+	}
+	pmm.buddy.head[order] = pfn;
+	pmm.buddy.count[order]++;
+}
+
+static void buddy_unlink(uint32_t pfn)
+{
+	struct pmm_block *block = &pmm.frames.table[pfn];
+
+	if (block->prev != PMM_NO_FRAME) {
+		pmm.frames.table[block->prev].next = block->next;
+	}
+	else {
+		pmm.buddy.head[block->order] = block->next;
+	}
+
+	if (block->next != PMM_NO_FRAME) {
+		pmm.frames.table[block->next].prev = block->prev;
+	}
+
+	pmm.buddy.count[block->order]--;
+	block->state = pmm_used;
+}
+
+static uint32_t buddy_alloc(uint32_t order)
+{
+	/* Find the smallest order that has a free block available. If there isn't
+	   one then carve more memory out of the spans that have not yet been
+	   given to the buddy lists. */
+	uint32_t k;
+	do {
+		k = order;
+		while (k <= PMM_MAX_ORDER && pmm.buddy.head[k] == PMM_NO_FRAME) {
+			++k;
+		}
+	} while (k > PMM_MAX_ORDER && pmm_carve());
+
+	if (k > PMM_MAX_ORDER) {
+		return PMM_NO_FRAME;
+	}
+
+	uint32_t pfn = pmm.buddy.head[k];
+	buddy_unlink(pfn);
+
+	/* Split the block down to the requested order, returning the upper half
+	   of each split to the free lists. */
+	while (k > order) {
+		--k;
+		buddy_push(pfn + (1 << k), k);
+	}
+
+	pmm.frames.table[pfn].order = order;
+	pmm.frames.table[pfn].state = pmm_used;
+	return pfn;
+}
+
+static void buddy_free(uint32_t pfn, uint32_t order)
+{
+	/* Merge the block with its buddy for as long as the buddy is also free and
+	   of the same order. */
+	while (order < PMM_MAX_ORDER) {
+		uint32_t buddy = pfn ^ (1 << order);
+		if (buddy >= pmm.frames.count) {
+			break;
+		}
+
+		struct pmm_block *block = &pmm.frames.table[buddy];
+		if (block->state != pmm_free || block->order != order) {
+			break;
+		}
+
+		buddy_unlink(buddy);
+		pfn &= ~(1 << order);
+		++order;
+	}
+
+	buddy_push(pfn, order);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void pmm_cache_refill(void)
+{
+	/* Prefer to take an entire batch as a single block, as it is a single
+	   split rather than a series of them. */
+	uint32_t pfn = buddy_alloc(PMM_CACHE_ORDER);
+	if (pfn != PMM_NO_FRAME) {
+		for (uint32_t i = 0; i < PMM_CACHE_BATCH; ++i) {
+			pmm.frames.table[pfn + i].order = 0;
+			pmm.frames.table[pfn + i].state = pmm_cached;
+			pmm.cache.frames[pmm.cache.count++] = pfn + i;
+		}
+		return;
+	}
+
+	/* Memory is too fragmented for that, so fall back to single frames. */
+	while (pmm.cache.count < PMM_CACHE_BATCH) {
+		if ((pfn = buddy_alloc(0)) == PMM_NO_FRAME) {
+			break;
+		}
+		pmm.frames.table[pfn].state = pmm_cached;
+		pmm.cache.frames[pmm.cache.count++] = pfn;
+	}
+}
+
+static void pmm_cache_drain(uint32_t count)
+{
+	while (count-- && pmm.cache.count > 0) {
+		buddy_free(pmm.cache.frames[--pmm.cache.count], 0);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t pmm_color(uint32_t pfn)
+{
+	return pfn & (pmm.colors.count - 1);
+}
+
+static void pmm_color_push(uint32_t pfn)
+{
+	uint32_t color = pmm_color(pfn);
+	pmm.frames.table[pfn].order = 0;
+	pmm.frames.table[pfn].state = pmm_cached;
+	pmm.frames.table[pfn].next = pmm.colors.head[color];
+	pmm.colors.head[color] = pfn;
+	pmm.colors.held++;
+}
+
+static uint32_t pmm_color_pop(uint32_t color)
+{
+	uint32_t pfn = pmm.colors.head[color];
+	if (pfn != PMM_NO_FRAME) {
+		pmm.colors.head[color] = pmm.frames.table[pfn].next;
+		pmm.colors.held--;
+	}
+	return pfn;
+}
+
+static void pmm_color_drain(void)
+{
+	for (uint32_t color = 0; pmm.colors.held > 0; ++color) {
+		uint32_t pfn;
+		while ((pfn = pmm_color_pop(color)) != PMM_NO_FRAME) {
+			buddy_free(pfn, 0);
+		}
+	}
+}
+
+static uint32_t pmm_color_take(uint32_t color)
+{
+	/* Frames that have already been held aside for the color are used
+	   first, followed by recently released frames in the cache. */
+	uint32_t pfn = pmm_color_pop(color);
+	if (pfn != PMM_NO_FRAME) {
+		return pfn;
+	}
+
+	for (uint32_t i = pmm.cache.count; i > 0; --i) {
+		if (pmm_color(pmm.cache.frames[i - 1]) == color) {
+			pfn = pmm.cache.frames[i - 1];
+			pmm.cache.frames[i - 1] = pmm.cache.frames[--pmm.cache.count];
+			return pfn;
+		}
+	}
+
+	/* Otherwise take a block that has exactly one frame of every color, and
+	   hold the rest of it aside. This is limited, so that frames are not held
+	   aside indefinitely when only a few colors are ever requested. */
+	if (pmm.colors.held + pmm.colors.count > PMM_MAX_COLORED) {
+		return PMM_NO_FRAME;
+	}
+
+	uint32_t base = buddy_alloc(pmm.colors.order);
+	if (base == PMM_NO_FRAME) {
+		return PMM_NO_FRAME;
+	}
+
+	for (uint32_t i = 0; i < pmm.colors.count; ++i) {
+		if (pmm_color(base + i) == color) {
+			pfn = base + i;
+		}
+		else {
+			pmm_color_push(base + i);
+		}
+	}
+	return pfn;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 
 oserr init_physical_memory(struct multiboot_info *mb)
 {
+	uint64_t init_start = cpu_ticks();
+
 	/* The first thing to ensure is that the multiboot information we got 
 	   actually contains what we need. If it does not then we're in trouble. */
 	if (!(mb->flags & MULTIBOOT_INFO_MEM_MAP)) {
@@ -71,11 +424,22 @@ oserr init_physical_memory(struct multiboot_info *mb)
 		);
 	}
 
-	/* Determine how much physical memory the system has. We can do this by
-	   adding up the upper and lower memory totals provided in the multiboot
-	   information. This may be incorrect on some systems and may need to be
-	   accounted for in the future. */
-	pmm.frames.count = (mb->mem_lower + mb->mem_upper) / (FRAME_SIZE >> 10);
+	struct multiboot_mmap_entry *mmap = (void *)mb->mmap_addr;
+	uint32_t mmap_size = mb->mmap_length;
+	uint32_t mmap_count = mmap_size / sizeof(*mmap);
+
+	/* Determine how much physical memory the system has. The upper and lower
+	   memory totals provided in the multiboot information stop at the first
+	   memory hole, so use the end of the highest available region in the
+	   memory map instead. */
+	uint64_t memory_end = 0;
+	for (uint32_t i = 0; i < mmap_count; ++i) {
+		if (mmap[i].type == MULTIBOOT_MEMORY_AVAILABLE) {
+			memory_end = MAX(memory_end, mmap[i].addr + mmap[i].len);
+		}
+	}
+	memory_end = MIN(memory_end, (uint64_t)PMM_MAX_FRAMES << FRAME_SHIFT);
+	pmm.frames.count = (uint32_t)(memory_end >> FRAME_SHIFT);
 
 	/* Record information regarding the kernel code */
 	pmm.kernel_code.start = mem_align((uintptr_t)&kernel_start, a_down);
@@ -111,49 +475,83 @@ oserr init_physical_memory(struct multiboot_info *mb)
 		);
 	}
 
-	/* Determine how much memory should be reserved for kernel working memory.
-	   Kernel working memory, or the _kernel heap_ is memory that can be
-	   dynamically allocated within the kernel itself. This should not be a
-	   lot of memory, and should ideally only be temporary use. */
-
-	/* TODO: Determine if this is needed. */
-
 	/* Record the BIOS memory. This is basically fixed across all systems so
 	   this is hardcoded. If this is found to have issues, then the range
 	   should be recalculated. */
 	pmm.bios.start = 0x00000000;	/* Beginning of Physical Memory */
 	pmm.bios.end =   0x00100000;	/* 1MiB */
 
-	/* Setup the stack required for storing available frames. */
-	uint32_t per_frame = FRAME_SIZE / sizeof(uintptr_t);
-	pmm.frames.stack.frames = (
-		(pmm.frames.count / per_frame) + (pmm.frames.count % per_frame ? 1 : 0)
+	/* Setup the frame table. This holds an entry for every frame of physical
+	   memory, and is reserved directly after the kernel modules. It must fit
+	   within the available region that follows the modules, as it is used
+	   before paging is enabled. If there is too much memory to describe, then
+	   we only manage as much as we are able to. */
+	uint64_t table_end = pmm.kernel_mods.end;
+	for (uint32_t i = 0; i < mmap_count; ++i) {
+		uint64_t end = mmap[i].addr + mmap[i].len;
+		if (mmap[i].type == MULTIBOOT_MEMORY_AVAILABLE
+			&& mmap[i].addr <= pmm.kernel_mods.end && end > table_end
+		) {
+			table_end = MIN(end, 0x100000000ULL);
+		}
+	}
+	uint32_t limit = (uint32_t)(table_end - pmm.kernel_mods.end) / (
+		sizeof(struct pmm_block)
 	);
-	pmm.frames.stack.base = (uintptr_t *)pmm.kernel_mods.end;
-	pmm.frames.stack.ptr = pmm.frames.stack.base;
-	pmm.frames.stack.end = (uintptr_t)pmm.frames.stack.base + (
-		pmm.frames.stack.frames * FRAME_SIZE
+	if (pmm.frames.count > limit) {
+		klogc(
+			swarn, "Only able to manage %d of %d frames of physical memory.\n",
+			limit, pmm.frames.count
+		);
+		pmm.frames.count = limit;
+	}
+
+	pmm.frames.table = (struct pmm_block *)pmm.kernel_mods.end;
+	pmm.kernel_reserved.start = pmm.kernel_mods.end;
+	pmm.kernel_reserved.end = mem_align(
+		pmm.kernel_reserved.start + 
+		(pmm.frames.count * sizeof(struct pmm_block)), a_up
 	);
 
-	/* At this point the ranges of physical memory are known. However we 
-	   still need to produce a stack of available frames. This stack also
-	   needs to account for any memory "holes" that are present. These holes
-	   are provided to us via the multiboot information in a memory map. */
-	struct multiboot_mmap_entry *mmap = (void *)mb->mmap_addr;
-	uint32_t mmap_size = mb->mmap_length;
-	uint32_t mmap_count = mmap_size / sizeof(*mmap);
+	for (uint32_t order = 0; order <= PMM_MAX_ORDER; ++order) {
+		pmm.buddy.head[order] = PMM_NO_FRAME;
+		pmm.buddy.count[order] = 0;
+	}
 
-	uintptr_t first_avail = pmm.frames.stack.end;
+	/* Account for the frames that have been reserved for the BIOS and the
+	   kernel. Available frames are accounted for as they are recorded. */
+	uint32_t code = (pmm.kernel_code.end - pmm.kernel_code.start) / FRAME_SIZE;
+	uint32_t mods = (pmm.kernel_mods.end - pmm.kernel_mods.start) / FRAME_SIZE;
+	pmm.frames.purposes[frame_bios] = (
+		(pmm.bios.end - pmm.bios.start) / FRAME_SIZE
+	);
+	pmm.frames.purposes[frame_kernel_code] = code;
+	pmm.frames.purposes[frame_module] = mods;
+	pmm.frames.purposes[frame_kernel_wired] = (
+		(pmm.kernel_reserved.end - pmm.kernel_code.start) / FRAME_SIZE
+	) - code - mods;
+
+	/* At this point the ranges of physical memory are known. However we 
+	   still need to record which spans of memory are available, so that the
+	   buddy lists can be populated from them. These spans also need to account
+	   for any memory "holes" that are present. These holes are provided to us
+	   via the multiboot information in a memory map. */
+	uintptr_t first_avail = pmm.kernel_reserved.end;
 	for (uint32_t i = 0; i < mmap_count; ++i) {
-		/* Determine the start of the region and the end of it. */
-		uintptr_t start = (uintptr_t)mmap[i].addr;
-		uintptr_t end = (uintptr_t)(mmap[i].addr + mmap[i].len);
-		
 		/* If the region is not usable then skip it. */
 		if (mmap[i].type != MULTIBOOT_MEMORY_AVAILABLE) {
 			continue;
 		}
 
+		/* Determine the start of the region and the end of it, ignoring any
+		   part of it that the frame table is unable to describe, or that is
+		   beyond 4GiB. */
+		uint64_t start = mmap[i].addr;
+		uint64_t end = MIN(
+			mmap[i].addr + mmap[i].len, pmm_address(pmm.frames.count)
+		);
+		end = MIN(end, pmm_address(PMM_LOW_FRAMES));
+
 		/* Is the first free frame after the of the region? If so then skip. */
 		if (first_avail >= end) {
 			continue;
@@ -162,26 +560,53 @@ oserr init_physical_memory(struct multiboot_info *mb)
 		/* Is the first free frame before the beginning of the region? */
 		start = (first_avail < start) ? start : first_avail;
 
-		/* Record the available frames in the stack */
-		for (; start < end; start += FRAME_SIZE)
-			pmm_record_frame(start);
+		/* Record the available frames as a span */
+		pmm_record_range(start, end);
 	}
+	pmm_use_spans(pmm.spans.count);
 
-	/* Confirm that the allocator is working correctly */
-	uintptr_t expected = pmm.frames.stack.end;
-	uintptr_t allocated = pmm_acquire_frame();
-	if (expected == allocated) {
-		if (pmm_release_frame(allocated) == e_ok) {
+	/* Memory beyond 4GiB is recorded as well, but it is not used until the
+	   paging code is able to address it. */
+	pmm.spans.high = pmm.spans.count;
+	for (uint32_t i = 0; i < mmap_count; ++i) {
+		if (mmap[i].type != MULTIBOOT_MEMORY_AVAILABLE) {
+			continue;
 		}
-		else {
+
+		uint64_t start = MAX(mmap[i].addr, pmm_address(PMM_LOW_FRAMES));
+		uint64_t end = MIN(
+			mmap[i].addr + mmap[i].len, pmm_address(pmm.frames.count)
+		);
+		if (start < end) {
+			pmm_record_range(start, end);
 		}
 	}
+
+#if defined(PMM_EAGER_INIT)
+	/* Populate the buddy lists with everything up front. This is only useful
+	   for comparing boot times against the on demand behaviour. */
+	while (pmm_carve());
+#endif
+
+	/* Confirm that the allocator is working correctly by requesting a block
+	   with a larger alignment than its size, and then releasing it. */
+	paddr_t block = pmm_acquire_frames(1, FRAME_SIZE << 4);
+	if (block && !(block & ((FRAME_SIZE << 4) - 1))) {
+		pmm_release_frames(block, 1);
+	}
 	else {
+		klogc(serr, "Physical memory manager failed self test (%llx)\n", block);
 	}
 
-	/* Make a note of how much memory has been "wired" into it. */
-	uintptr_t s = 0, e = 0;
-	pmm_frame_range(frame_kernel_wired, &s, &e);
+	klogc(
+		sok, "Physical memory manager has %d frames available (%d KiB)\n",
+		pmm.frames.available, pmm.frames.available * (FRAME_SIZE >> 10)
+	);
+	klogc(
+		sinfo, "Physical memory manager initialised in %llu cycles "
+		"(%d of %d frames populated)\n",
+		cpu_ticks() - init_start, pmm.spans.carved, pmm.frames.available
+	);
 
 	/* Reaching this point is a good indication of a successful setup */
 	return e_ok;
@@ -189,39 +614,177 @@ oserr init_physical_memory(struct multiboot_info *mb)
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void pmm_record_frame(uintptr_t frame)
+void pmm_record_range(uint64_t start, uint64_t end)
 {
 	/* Special case: some memory maps indicate parts of the lower 1MiB are free.
 	   We need to ignore these. */
-	if (frame < 0x00100000)
+	start = MAX(start, pmm.bios.end);
+
+	/* Make sure we only take complete frames from the region. */
+	uint32_t pfn = (uint32_t)((start + FRAME_SIZE - 1) / FRAME_SIZE);
+	uint32_t last = (uint32_t)(end / FRAME_SIZE);
+	if (pfn >= last) {
 		return;
+	}
 
-	*pmm.frames.stack.base++ = frame;
-	pmm.frames.stack.available++;
+	if (pmm.spans.count >= PMM_MAX_SPANS) {
+		klogc(
+			swarn, "Too many memory spans. Ignoring frames %d-%d\n", pfn, last
+		);
+		return;
+	}
+
+	pmm.spans.list[pmm.spans.count].pfn = pfn;
+	pmm.spans.list[pmm.spans.count].end = last;
+	pmm.spans.count++;
 }
 
-oserr pmm_release_frame(uintptr_t frame)
+void pmm_use_spans(uint32_t limit)
 {
-	/* Check to ensure there is space in the stack. This should never fail. */
-	if (pmm.frames.stack.available >= pmm.frames.count) {
-		klogc(
-			serr, "Available frame stack is full. Unable to release frame %p\n",
-			frame
-		);
+	/* The frames of a span only become available once the span is usable. */
+	for (uint32_t i = pmm.spans.limit; i < limit; ++i) {
+		uint32_t count = pmm.spans.list[i].end - pmm.spans.list[i].pfn;
+		pmm.frames.available += count;
+		pmm.frames.purposes[frame_available] += count;
+	}
+	pmm.spans.limit = limit;
+}
+
+bool pmm_carve(void)
+{
+	/* Find the next span that still has frames in it. */
+	while (pmm.spans.next < pmm.spans.limit) {
+		struct pmm_span *span = &pmm.spans.list[pmm.spans.next];
+		if (span->pfn < span->end) {
+			break;
+		}
+		pmm.spans.next++;
+	}
+
+	if (pmm.spans.next >= pmm.spans.limit) {
+		return false;
+	}
+
+	/* Take the portion of the span that lies within the current window. If
+	   the window has not been used before then its frame table entries need
+	   to be initialised first. */
+	struct pmm_span *span = &pmm.spans.list[pmm.spans.next];
+	uint32_t pfn = span->pfn;
+	uint32_t window = pfn / PMM_WINDOW_FRAMES;
+	uint32_t last = MIN(span->end, (window + 1) * PMM_WINDOW_FRAMES);
+
+	if (!pmm_window_ready(pfn)) {
+		uint32_t first = window * PMM_WINDOW_FRAMES;
+		uint32_t count = MIN(PMM_WINDOW_FRAMES, pmm.frames.count - first);
+		memset(&pmm.frames.table[first], 0, count * sizeof(struct pmm_block));
+		pmm.spans.windows[window >> 5] |= (1 << (window & 0x1F));
+
+		/* Frames reserved for the BIOS and kernel have already been accounted
+		   for. We just need to record their purpose in the table. */
+		for (uint32_t i = first; i < first + count; ++i) {
+			if (pmm_address(i) >= pmm.kernel_reserved.end) {
+				break;
+			}
+			pmm.frames.table[i].frame.s.purpose = pmm_range_purpose(
+				pmm_address(i)
+			);
+		}
+	}
+	span->pfn = last;
+	pmm.spans.carved += (last - pfn);
+
+	for (uint32_t i = pfn; i < last; ++i) {
+		pmm.frames.table[i].frame.s.purpose = frame_available;
+	}
+
+	/* Break the range into the largest naturally aligned blocks possible. */
+	while (pfn < last) {
+		uint32_t order = PMM_MAX_ORDER;
+		while (order > 0) {
+			uint32_t size = 1 << order;
+			if (!(pfn & (size - 1)) && (pfn + size) <= last) {
+				break;
+			}
+			--order;
+		}
+
+		buddy_push(pfn, order);
+		pfn += (1 << order);
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static oserr __pmm_release_frame(paddr_t frame)
+{
+	/* Check to ensure the frame is one that we actually handed out. */
+	uint32_t pfn = pmm_pfn(frame);
+	if (!pmm_frame_valid(pfn) || (frame & (FRAME_SIZE - 1))
+		|| pmm.frames.table[pfn].state != pmm_used
+		|| pmm.frames.table[pfn].order != 0
+	) {
+		klogc(serr, "Unable to release frame %llx\n", frame);
 		return e_fail;
 	}
 
-	*--pmm.frames.stack.ptr = frame;
-	pmm.frames.stack.available++;
+	/* Only return the frame once the last reference to it has gone. */
+	struct pmm_block *block = &pmm.frames.table[pfn];
+	if (block->refs > 1 || (block->frame.s.flags & frame_pinned)) {
+		block->refs -= (block->refs > 1) ? 1 : 0;
+		return e_ok;
+	}
+	pmm_unclaim(pfn, 1);
+
+	/* If the cache is full, then return a batch of frames to the buddy lists
+	   so that they can be merged. */
+	if (pmm.cache.count >= PMM_CACHE_SIZE) {
+		pmm_cache_drain(PMM_CACHE_BATCH);
+	}
+
+	pmm.frames.table[pfn].state = pmm_cached;
+	pmm.cache.frames[pmm.cache.count++] = pfn;
+	pmm.frames.available++;
 
 	return e_ok;
 }
 
-uintptr_t pmm_acquire_frame(void)
+oserr pmm_release_frame(paddr_t frame)
 {
+	uintptr_t flags = irq_save();
+	oserr result = __pmm_release_frame(frame);
+	irq_restore(flags);
+	return result;
+}
+
+static paddr_t __pmm_acquire_frame(void)
+{
+	/* Make sure the cache has a frame to hand out. */
+	if (pmm.cache.count == 0) {
+		pmm_cache_refill();
+	}
+
+	/* Frames that are being held aside for their color can be used by any
+	   request once everything else has run out. */
+	if (pmm.cache.count == 0 && pmm.colors.held > 0) {
+		pmm_color_drain();
+		pmm_cache_refill();
+	}
+
+	/* Before giving up, ask the rest of the system to give back any memory
+	   that it can spare. Frames that are given back are usually placed
+	   straight into the cache. */
+	if (pmm.cache.count == 0) {
+		reclaim_frames(RECLAIM_DIRECT_FRAMES);
+		if (pmm.cache.count == 0) {
+			pmm_cache_refill();
+		}
+	}
+
 	/* Check to ensure there are available frames. If there are no available
 	   frames then panic. */
-	if (pmm.frames.stack.available <= 0) {
+	if (pmm.cache.count == 0) {
 		panic(
 			"Out of Memory",
 			"The system has exhausted all available physical memory.\n"
@@ -229,13 +792,205 @@ uintptr_t pmm_acquire_frame(void)
 		);
 	}
 
-	pmm.frames.stack.available--;
-	return *pmm.frames.stack.ptr++;
+	uint32_t pfn = pmm.cache.frames[--pmm.cache.count];
+	pmm.frames.table[pfn].state = pmm_used;
+	pmm.frames.available--;
+	pmm_claim(pfn, 1);
+	return pmm_address(pfn);
+}
+
+paddr_t pmm_acquire_frame(void)
+{
+	uintptr_t flags = irq_save();
+	paddr_t result = __pmm_acquire_frame();
+	irq_restore(flags);
+	return result;
+}
+
+static paddr_t __pmm_acquire_colored_frame(uint32_t color)
+{
+	if (pmm.colors.count <= 1) {
+		return __pmm_acquire_frame();
+	}
+
+	if (color == PMM_COLOR_DIVERSE) {
+		color = pmm.colors.next++;
+	}
+
+	/* Coloring is only a preference, so a frame of any color is better than
+	   none at all. */
+	uint32_t pfn = pmm_color_take(color & (pmm.colors.count - 1));
+	if (pfn == PMM_NO_FRAME) {
+		pmm.colors.misses++;
+		return __pmm_acquire_frame();
+	}
+	pmm.colors.hits++;
+
+	pmm.frames.table[pfn].order = 0;
+	pmm.frames.table[pfn].state = pmm_used;
+	pmm.frames.available--;
+	pmm_claim(pfn, 1);
+	return pmm_address(pfn);
+}
+
+paddr_t pmm_acquire_colored_frame(uint32_t color)
+{
+	uintptr_t flags = irq_save();
+	paddr_t result = __pmm_acquire_colored_frame(color);
+	irq_restore(flags);
+	return result;
+}
+
+void pmm_set_frame_colors(uint32_t colors)
+{
+	uint32_t limit = MIN(colors, PMM_MAX_COLORS);
+	uint32_t order = 0;
+	while ((2U << order) <= limit) {
+		++order;
+	}
+
+	/* Frames held aside for the old colors are returned first. */
+	uintptr_t flags = irq_save();
+	pmm_color_drain();
+	pmm.colors.count = 1 << order;
+	pmm.colors.order = order;
+	pmm.colors.next = 0;
+	for (uint32_t i = 0; i < PMM_MAX_COLORS; ++i) {
+		pmm.colors.head[i] = PMM_NO_FRAME;
+	}
+	irq_restore(flags);
+}
+
+uint32_t pmm_frame_colors(void)
+{
+	return (pmm.colors.count > 1) ? pmm.colors.count : 1;
+}
+
+uint32_t pmm_frame_color(paddr_t frame)
+{
+	return (pmm.colors.count > 1) ? pmm_color(pmm_pfn(frame)) : 0;
+}
+
+void pmm_get_color_stats(struct pmm_color_stats *stats)
+{
+	stats->colors = pmm_frame_colors();
+	stats->held = pmm.colors.held;
+	stats->hits = pmm.colors.hits;
+	stats->misses = pmm.colors.misses;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static paddr_t __pmm_acquire_frames(uint32_t order, uint32_t align)
+{
+	if (order > PMM_MAX_ORDER) {
+		klogc(swarn, "Unable to acquire a block of order %d\n", order);
+		return 0;
+	}
+
+	/* Blocks are naturally aligned to their own size, so a larger alignment
+	   can be satisfied by acquiring a larger block and releasing the 
+	   remainder. */
+	uint32_t align_order = order;
+	while (((uint32_t)FRAME_SIZE << align_order) < align) {
+		if (++align_order > PMM_MAX_ORDER) {
+			klogc(swarn, "Unable to align a block to %p\n", align);
+			return 0;
+		}
+	}
+
+	uint32_t pfn = buddy_alloc(align_order);
+	if (pfn == PMM_NO_FRAME) {
+		/* The cache may be holding on to the frames that are required to
+		   form a block of this size. Return them and try again. */
+		pmm_cache_drain(pmm.cache.count);
+		pmm_color_drain();
+		if ((pfn = buddy_alloc(align_order)) == PMM_NO_FRAME) {
+			return 0;
+		}
+	}
+
+	/* Return the unwanted upper portion of the block. */
+	for (uint32_t k = order; k < align_order; ++k) {
+		buddy_free(pfn + (1 << k), k);
+	}
+	pmm.frames.table[pfn].order = order;
+
+	pmm.frames.available -= (1 << order);
+	pmm_claim(pfn, 1 << order);
+	return pmm_address(pfn);
+}
+
+paddr_t pmm_acquire_frames(uint32_t order, uint32_t align)
+{
+	uintptr_t flags = irq_save();
+	paddr_t result = __pmm_acquire_frames(order, align);
+	irq_restore(flags);
+	return result;
+}
+
+static oserr __pmm_release_frames(paddr_t frame, uint32_t order)
+{
+	/* Make sure the block being returned is the one that was handed out. */
+	uint32_t pfn = pmm_pfn(frame);
+	if (!pmm_frame_valid(pfn) || (pfn & ((1 << order) - 1))
+		|| pmm.frames.table[pfn].state != pmm_used
+		|| pmm.frames.table[pfn].order != order
+	) {
+		klogc(serr, "Unable to release block %llx (order %d)\n", frame, order);
+		return e_fail;
+	}
+
+	pmm_unclaim(pfn, 1 << order);
+	buddy_free(pfn, order);
+	pmm.frames.available += (1 << order);
+	return e_ok;
+}
+
+oserr pmm_release_frames(paddr_t frame, uint32_t order)
+{
+	uintptr_t flags = irq_save();
+	oserr result = __pmm_release_frames(frame, order);
+	irq_restore(flags);
+	return result;
+}
+
+static oserr __pmm_split_frames(paddr_t frame, uint32_t order)
+{
+	uint32_t pfn = pmm_pfn(frame);
+	if (!pmm_frame_valid(pfn) || (pfn & ((1 << order) - 1))
+		|| pmm.frames.table[pfn].state != pmm_used
+		|| pmm.frames.table[pfn].order != order
+	) {
+		klogc(serr, "Unable to split block %llx (order %d)\n", frame, order);
+		return e_fail;
+	}
+
+	/* Every frame of the block has already been claimed, so each one just
+	   needs to become the head of its own single frame block. */
+	for (uint32_t i = 0; i < (1U << order); ++i) {
+		pmm.frames.table[pfn + i].state = pmm_used;
+		pmm.frames.table[pfn + i].order = 0;
+	}
+	return e_ok;
+}
+
+oserr pmm_split_frames(paddr_t frame, uint32_t order)
+{
+	uintptr_t flags = irq_save();
+	oserr result = __pmm_split_frames(frame, order);
+	irq_restore(flags);
+	return result;
+}
+
+uint32_t pmm_available_frames(void)
+{
+	return pmm.frames.available;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-enum frame_purpose pmm_frame_purpose(uintptr_t frame)
+enum frame_purpose pmm_range_purpose(paddr_t frame)
 {
 	if (frame >= pmm.bios.start && frame < pmm.bios.end) {
 		return frame_bios;
@@ -246,7 +1001,8 @@ enum frame_purpose pmm_frame_purpose(uintptr_t frame)
 	else if (frame >= pmm.kernel_mods.start && frame < pmm.kernel_mods.end) {
 		return frame_module;
 	}
-	else if (frame >= pmm.kernel_code.start && frame < pmm.frames.stack.end) {
+	else if (frame >= pmm.kernel_code.start
+		&& frame < pmm.kernel_reserved.end) {
 		return frame_kernel_wired;
 	}
 	else {
@@ -254,6 +1010,26 @@ enum frame_purpose pmm_frame_purpose(uintptr_t frame)
 	}
 }
 
+enum frame_purpose pmm_frame_purpose(paddr_t frame)
+{
+	/* The frame table is authoritative for any frame that it describes. */
+	uint32_t pfn = pmm_pfn(frame);
+	if (pmm_frame_valid(pfn)) {
+		return pmm.frames.table[pfn].frame.s.purpose;
+	}
+
+	/* Frames that have not yet been given to the buddy lists are available,
+	   as long as they belong to one of the recorded spans. */
+	for (uint32_t i = pmm.spans.next; i < pmm.spans.limit; ++i) {
+		struct pmm_span *span = &pmm.spans.list[i];
+		if (pfn >= span->pfn && pfn < span->end) {
+			return frame_available;
+		}
+	}
+
+	return pmm_range_purpose(frame);
+}
+
 oserr pmm_frame_range(enum frame_purpose purpose, uintptr_t *s, uintptr_t *e)
 {
 	switch (purpose) {
@@ -274,15 +1050,131 @@ oserr pmm_frame_range(enum frame_purpose purpose, uintptr_t *s, uintptr_t *e)
 
 		case frame_kernel_wired:
 			*s = pmm.kernel_code.start;
-			*e = pmm.frames.stack.end;
+			*e = pmm.kernel_reserved.end;
 			return e_ok;
+
+		default:
+			break;
 	}
 
 	/* Reaching this point indicates that the purpose could not be determined */
 	return e_fail;
 }
 
-oserr pmm_set_frame_purpose(uintptr_t frame, enum frame_purpose purpose)
+static oserr __pmm_set_frame_purpose(
+	paddr_t frame, enum frame_purpose purpose
+) {
+	/* Only frames that have been acquired can have their purpose changed. The
+	   purpose of anything else is determined by the Physical Memory Manager. */
+	uint32_t pfn = pmm_pfn(frame);
+	if (!pmm_frame_valid(pfn) || pmm.frames.table[pfn].refs == 0
+		|| purpose == frame_available || purpose >= frame_purpose_count
+	) {
+		klogc(swarn, "Unable to set purpose of frame %llx\n", frame);
+		return e_fail;
+	}
+
+	pmm_set_purpose(pfn, purpose);
+	return e_ok;
+}
+
+oserr pmm_set_frame_purpose(paddr_t frame, enum frame_purpose purpose)
+{
+	uintptr_t flags = irq_save();
+	oserr result = __pmm_set_frame_purpose(frame, purpose);
+	irq_restore(flags);
+	return result;
+}
+
+uint8_t pmm_frame_flags(paddr_t frame)
+{
+	uint32_t pfn = pmm_pfn(frame);
+	return pmm_frame_valid(pfn) ? pmm.frames.table[pfn].frame.s.flags : 0;
+}
+
+static oserr __pmm_set_frame_flags(paddr_t frame, uint8_t flags)
+{
+	uint32_t pfn = pmm_pfn(frame);
+	if (!pmm_frame_valid(pfn) || pmm.frames.table[pfn].refs == 0) {
+		klogc(swarn, "Unable to set flags of frame %llx\n", frame);
+		return e_fail;
+	}
+
+	pmm.frames.table[pfn].frame.s.flags = flags;
+	return e_ok;
+}
+
+oserr pmm_set_frame_flags(paddr_t frame, uint8_t flags)
+{
+	uintptr_t irq = irq_save();
+	oserr result = __pmm_set_frame_flags(frame, flags);
+	irq_restore(irq);
+	return result;
+}
+
+uint32_t pmm_frame_count(enum frame_purpose purpose)
+{
+	return (purpose < frame_purpose_count) ? pmm.frames.purposes[purpose] : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static oserr __pmm_retain_frame(paddr_t frame)
+{
+	uint32_t pfn = pmm_pfn(frame);
+	if (!pmm_frame_valid(pfn) || pmm.frames.table[pfn].refs == 0
+		|| pmm.frames.table[pfn].refs == 0xFFFF
+	) {
+		klogc(serr, "Unable to retain frame %llx\n", frame);
+		return e_fail;
+	}
+
+	pmm.frames.table[pfn].refs++;
+	return e_ok;
+}
+
+oserr pmm_retain_frame(paddr_t frame)
+{
+	uintptr_t flags = irq_save();
+	oserr result = __pmm_retain_frame(frame);
+	irq_restore(flags);
+	return result;
+}
+
+uint32_t pmm_frame_references(paddr_t frame)
+{
+	uint32_t pfn = pmm_pfn(frame);
+	return pmm_frame_valid(pfn) ? pmm.frames.table[pfn].refs : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool pmm_has_high_memory(void)
+{
+	return (pmm.spans.high < pmm.spans.count);
+}
+
+void pmm_enable_high_memory(void)
+{
+	uintptr_t flags = irq_save();
+	uint32_t available = pmm.frames.available;
+	pmm_use_spans(pmm.spans.count);
+	available = pmm.frames.available - available;
+	irq_restore(flags);
+
+	klogc(
+		sok, "Physical memory beyond 4GiB enabled (%d KiB)\n",
+		available * (FRAME_SIZE >> 10)
+	);
+}
+
+void pmm_table_range(uintptr_t *s, uintptr_t *e)
+{
+	*s = pmm.kernel_reserved.start;
+	*e = pmm.kernel_reserved.end;
+}
+
+void pmm_relocate_table(uintptr_t linear)
 {
-	/* TODO */
+	pmm.frames.table = (struct pmm_block *)linear;
 }
\ No newline at end of file
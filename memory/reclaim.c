@@ -0,0 +1,200 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <reclaim.h>
+#include <pmm.h>
+#include <vmm.h>
+#include <slab.h>
+#include <heap.h>
+#include <context.h>
+#include <print.h>
+#include <arch.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+static struct {
+	struct reclaim_shrinker shrinkers[RECLAIM_MAX_SHRINKERS];
+	uint32_t count;
+	bool active;
+	struct reclaim_stats stats;
+} reclaim;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t __reclaim_zero_pool_count(void *data)
+{
+	(void)data;
+	struct vmm_stats stats;
+	vmm_get_stats(&stats);
+	return stats.zero_pool_frames;
+}
+
+static uint32_t __reclaim_zero_pool_scan(void *data, uint32_t count)
+{
+	(void)data;
+	return vmm_release_zeroed_frames(count);
+}
+
+static uint32_t __reclaim_slab_count(void *data)
+{
+	(void)data;
+	uint32_t count = 0;
+	const struct kmem_cache *cache;
+	for (uint32_t i = 0; (cache = kmem_get_cache(i)) != NULL; ++i) {
+		count += cache->empty ? cache->pages : 0;
+	}
+	return count;
+}
+
+static uint32_t __reclaim_slab_scan(void *data, uint32_t count)
+{
+	(void)data;
+	return kmem_shrink(count);
+}
+
+static uint32_t __reclaim_heap_count(void *data)
+{
+	return ((struct heap *)data)->retained;
+}
+
+static uint32_t __reclaim_heap_scan(void *data, uint32_t count)
+{
+	return heap_shrink(data, count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/* Scan each shrinker in turn until _count_ frames have been given back. Only
+   one reclaim runs at a time, as a shrinker can itself need a frame, which
+   must not start another reclaim. */
+static uint32_t __reclaim_run(uint32_t count)
+{
+	uintptr_t flags = irq_save();
+	if (reclaim.active) {
+		irq_restore(flags);
+		return 0;
+	}
+	reclaim.active = true;
+	irq_restore(flags);
+
+	uint32_t freed = 0;
+	for (uint32_t i = 0; i < reclaim.count && freed < count; ++i) {
+		struct reclaim_shrinker *shrinker = &reclaim.shrinkers[i];
+		if (shrinker->count(shrinker->data) == 0) {
+			continue;
+		}
+
+		uint32_t released = shrinker->scan(shrinker->data, count - freed);
+		shrinker->calls++;
+		shrinker->freed += released;
+		freed += released;
+	}
+
+	reclaim.active = false;
+	return freed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+oserr init_reclaim(void)
+{
+	/* Pre-zeroed frames are only a cache, and are given back first. Empty
+	   slabs follow, and finally the heap's retained pages, which are the
+	   most likely to be needed again soon. */
+	struct context *ctx = current_context();
+	if (!ctx
+		|| reclaim_register("zero pool", __reclaim_zero_pool_count,
+			__reclaim_zero_pool_scan, NULL) != e_ok
+		|| reclaim_register("slab caches", __reclaim_slab_count,
+			__reclaim_slab_scan, NULL) != e_ok
+		|| reclaim_register("kernel heap", __reclaim_heap_count,
+			__reclaim_heap_scan, ctx->heap) != e_ok
+	) {
+		klogc(serr, "Failed to register the memory shrinkers.\n");
+		return e_fail;
+	}
+	return e_ok;
+}
+
+oserr reclaim_register(
+	const char *name, reclaim_count_t count, reclaim_scan_t scan, void *data
+) {
+	if (!count || !scan) {
+		klogc(swarn, "Invalid shrinker %s\n", name);
+		return e_fail;
+	}
+
+	uintptr_t flags = irq_save();
+	if (reclaim.count >= RECLAIM_MAX_SHRINKERS) {
+		irq_restore(flags);
+		klogc(serr, "Too many shrinkers to register %s\n", name);
+		return e_fail;
+	}
+
+	struct reclaim_shrinker *shrinker = &reclaim.shrinkers[reclaim.count];
+	shrinker->name = name;
+	shrinker->count = count;
+	shrinker->scan = scan;
+	shrinker->data = data;
+	shrinker->calls = 0;
+	shrinker->freed = 0;
+	reclaim.count++;
+	irq_restore(flags);
+
+	return e_ok;
+}
+
+uint32_t reclaim_frames(uint32_t count)
+{
+	reclaim.stats.direct++;
+	uint32_t freed = __reclaim_run(count);
+	if (freed == 0) {
+		reclaim.stats.failures++;
+	}
+	return freed;
+}
+
+bool reclaim_background(void)
+{
+	uint32_t available = pmm_available_frames();
+	if (available >= RECLAIM_LOW_FRAMES) {
+		return false;
+	}
+
+	reclaim.stats.background++;
+	return __reclaim_run(RECLAIM_HIGH_FRAMES - available) > 0;
+}
+
+bool reclaim_pressure(void)
+{
+	return pmm_available_frames() < RECLAIM_HIGH_FRAMES;
+}
+
+const struct reclaim_shrinker *reclaim_get_shrinker(uint32_t index)
+{
+	return (index < reclaim.count) ? &reclaim.shrinkers[index] : NULL;
+}
+
+void reclaim_get_stats(struct reclaim_stats *stats)
+{
+	*stats = reclaim.stats;
+}
\ No newline at end of file
@@ -0,0 +1,158 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <reserve.h>
+#include <alloc.h>
+#include <pmm.h>
+#include <string.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+/* Each slot holds either an allocation or nothing. A slot is emptied with a
+   single atomic exchange, so an interrupt handler can never be left waiting
+   for a thread that was interrupted whilst using the reserve. Only the thread
+   that refills the reserve ever fills a slot. Frames are held by frame number,
+   as frame 0 is never handed out by the Physical Memory Manager. */
+static struct {
+	void *volatile objects[RESERVE_CLASSES][RESERVE_OBJECTS];
+	volatile uint32_t frames[RESERVE_FRAMES];
+	volatile uint32_t hits;
+	volatile uint32_t misses;
+	volatile uint32_t refills;
+} reserve;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t __reserve_class_size(uint32_t class)
+{
+	return 1U << (RESERVE_MIN_SHIFT + (class * 2));
+}
+
+static inline uint32_t __reserve_class(uint32_t size)
+{
+	uint32_t class = 0;
+	while (class < RESERVE_CLASSES && size > __reserve_class_size(class)) {
+		++class;
+	}
+	return class;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void *reserve_alloc(uint32_t size)
+{
+	/* Larger classes are used if the smallest suitable one is empty. */
+	for (uint32_t class = __reserve_class(size); class < RESERVE_CLASSES;
+		++class
+	) {
+		for (uint32_t n = 0; n < RESERVE_OBJECTS; ++n) {
+			void *volatile *slot = &reserve.objects[class][n];
+			void *ptr = *slot ? __sync_lock_test_and_set(slot, NULL) : NULL;
+			if (ptr) {
+				__sync_fetch_and_add(&reserve.hits, 1);
+				return ptr;
+			}
+		}
+	}
+
+	__sync_fetch_and_add(&reserve.misses, 1);
+	return NULL;
+}
+
+paddr_t reserve_acquire_frame(void)
+{
+	for (uint32_t n = 0; n < RESERVE_FRAMES; ++n) {
+		volatile uint32_t *slot = &reserve.frames[n];
+		uint32_t pfn = *slot ? __sync_lock_test_and_set(slot, 0) : 0;
+		if (pfn) {
+			__sync_fetch_and_add(&reserve.hits, 1);
+			return (paddr_t)pfn << FRAME_SHIFT;
+		}
+	}
+
+	__sync_fetch_and_add(&reserve.misses, 1);
+	return 0;
+}
+
+bool reserve_refill(void)
+{
+	/* The smallest classes are refilled first, as they are used most. The
+	   memory is written to so that it is mapped before it is handed out, as
+	   an interrupt handler must not fault on it. */
+	for (uint32_t class = 0; class < RESERVE_CLASSES; ++class) {
+		for (uint32_t n = 0; n < RESERVE_OBJECTS; ++n) {
+			void *volatile *slot = &reserve.objects[class][n];
+			if (*slot) {
+				continue;
+			}
+
+			/* The allocation is recorded once, by kalloc_atomic(), when it is
+			   handed out rather than when the slot is filled. */
+			void *ptr = __kalloc_unrecorded(__reserve_class_size(class));
+			if (!ptr) {
+				return false;
+			}
+
+			memset(ptr, 0, __reserve_class_size(class));
+			__sync_synchronize();
+			*slot = ptr;
+			__sync_fetch_and_add(&reserve.refills, 1);
+			return true;
+		}
+	}
+
+	/* Frames are only reserved whilst there are plenty left, as running out
+	   of physical memory is fatal. */
+	if (pmm_available_frames() <= RESERVE_FRAMES) {
+		return false;
+	}
+
+	for (uint32_t n = 0; n < RESERVE_FRAMES; ++n) {
+		volatile uint32_t *slot = &reserve.frames[n];
+		if (*slot == 0) {
+			*slot = (uint32_t)(pmm_acquire_frame() >> FRAME_SHIFT);
+			__sync_fetch_and_add(&reserve.refills, 1);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void reserve_get_stats(struct reserve_stats *stats)
+{
+	for (uint32_t class = 0; class < RESERVE_CLASSES; ++class) {
+		stats->objects[class] = 0;
+		for (uint32_t n = 0; n < RESERVE_OBJECTS; ++n) {
+			stats->objects[class] += (reserve.objects[class][n] != NULL);
+		}
+	}
+
+	stats->frames = 0;
+	for (uint32_t n = 0; n < RESERVE_FRAMES; ++n) {
+		stats->frames += (reserve.frames[n] != 0);
+	}
+
+	stats->hits = reserve.hits;
+	stats->misses = reserve.misses;
+	stats->refills = reserve.refills;
+}
\ No newline at end of file
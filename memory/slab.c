@@ -0,0 +1,300 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <slab.h>
+#include <vmm.h>
+#include <print.h>
+#include <arch.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+/* A slab is grown until it holds at least this many objects, or until it
+   reaches the maximum number of pages. */
+#define KMEM_MIN_OBJECTS	8
+#define KMEM_MAX_SLAB_PAGES	16
+
+static struct {
+	struct kmem_cache cache[KMEM_MAX_CACHES];
+	uint32_t count;
+} caches;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t __kmem_align(uint32_t value, uint32_t align)
+{
+	return (value + align - 1) & ~(align - 1);
+}
+
+static inline void **__kmem_link(struct kmem_cache *cache, void *object)
+{
+	return (void **)((uintptr_t)object + cache->link);
+}
+
+static inline struct kmem_slab *__kmem_slab(
+	struct kmem_cache *cache, void *object
+) {
+	uintptr_t mask = (cache->pages * PAGE_SIZE) - 1;
+	return (struct kmem_slab *)((uintptr_t)object & ~mask);
+}
+
+static void __kmem_push(struct kmem_slab **list, struct kmem_slab *slab)
+{
+	slab->back = NULL;
+	slab->next = *list;
+	if (*list) {
+		(*list)->back = slab;
+	}
+	*list = slab;
+}
+
+static void __kmem_remove(struct kmem_slab **list, struct kmem_slab *slab)
+{
+	if (slab->back) {
+		slab->back->next = slab->next;
+	}
+	else {
+		*list = slab->next;
+	}
+
+	if (slab->next) {
+		slab->next->back = slab->back;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static struct kmem_slab *__kmem_grow(struct kmem_cache *cache)
+{
+	/* The slab is aligned to its own size so that the slab of an object can
+	   be found from the object's address alone. */
+	uintptr_t base = vmm_acquire_any_pages(cache->pages, cache->pages);
+	if (base == 0) {
+		klogc(swarn, "Failed to acquire a slab for cache %s\n", cache->name);
+		return NULL;
+	}
+
+	struct kmem_slab *slab = (void *)base;
+	slab->cache = cache;
+	slab->next = NULL;
+	slab->back = NULL;
+	slab->free = NULL;
+	slab->inuse = 0;
+
+	/* Construct each of the objects and thread them onto the free list, in
+	   reverse so that they are handed out in address order. */
+	for (uint32_t i = cache->capacity; i > 0; --i) {
+		void *object = (void *)(base + cache->offset + (i - 1) * cache->stride);
+		if (cache->ctor) {
+			cache->ctor(object);
+		}
+		*__kmem_link(cache, object) = slab->free;
+		slab->free = object;
+	}
+
+	return slab;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct kmem_cache *kmem_cache_create(
+	const char *name, uint32_t size, uint32_t align, kmem_ctor_t ctor
+) {
+	if (align == 0) {
+		align = sizeof(void *);
+	}
+
+	if (size == 0 || (align & (align - 1)) || align > PAGE_SIZE) {
+		klogc(serr, "Invalid object cache %s (%d:%d)\n", name, size, align);
+		return NULL;
+	}
+
+	/* Free objects hold the link to the next free object. Constructed objects
+	   must keep their state while free, so the link is placed after them. */
+	uint32_t link = 0;
+	uint32_t span = size;
+	if (ctor) {
+		link = __kmem_align(size, sizeof(void *));
+		span = link + sizeof(void *);
+	}
+	else if (span < sizeof(void *)) {
+		span = sizeof(void *);
+	}
+
+	uint32_t stride = __kmem_align(span, align);
+	uint32_t offset = __kmem_align(sizeof(struct kmem_slab), align);
+
+	/* Find the size of slab needed to hold a reasonable number of objects. */
+	uint32_t pages = 1;
+	while (((pages * PAGE_SIZE) - offset) / stride < KMEM_MIN_OBJECTS
+		&& pages < KMEM_MAX_SLAB_PAGES
+	) {
+		pages <<= 1;
+	}
+
+	uint32_t capacity = ((pages * PAGE_SIZE) - offset) / stride;
+	if (capacity == 0) {
+		klogc(serr, "Objects of cache %s are too large (%d)\n", name, size);
+		return NULL;
+	}
+
+	uintptr_t flags = irq_save();
+	if (caches.count >= KMEM_MAX_CACHES) {
+		irq_restore(flags);
+		klogc(serr, "Too many object caches for %s\n", name);
+		return NULL;
+	}
+	struct kmem_cache *cache = &caches.cache[caches.count++];
+	irq_restore(flags);
+
+	cache->name = name;
+	cache->size = size;
+	cache->stride = stride;
+	cache->link = link;
+	cache->offset = offset;
+	cache->pages = pages;
+	cache->capacity = capacity;
+	cache->ctor = ctor;
+	cache->partial = NULL;
+	cache->empty = NULL;
+	cache->slabs = 0;
+	cache->objects = 0;
+
+	return cache;
+}
+
+const struct kmem_cache *kmem_get_cache(uint32_t index)
+{
+	return (index < caches.count) ? &caches.cache[index] : NULL;
+}
+
+uint32_t kmem_shrink(uint32_t count)
+{
+	uint32_t released = 0;
+	for (uint32_t i = 0; i < caches.count && released < count; ++i) {
+		struct kmem_cache *cache = &caches.cache[i];
+
+		uintptr_t flags = irq_save();
+		struct kmem_slab *slab = cache->empty;
+		if (slab) {
+			__kmem_remove(&cache->empty, slab);
+			cache->slabs--;
+		}
+		irq_restore(flags);
+
+		if (slab) {
+			vmm_release_any_pages((uintptr_t)slab, cache->pages);
+			released += cache->pages;
+		}
+	}
+	return released;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+	if (!cache) {
+		klogc(swarn, "Bad allocation attempt on NULL object cache.\n");
+		return NULL;
+	}
+
+	/* Partially used slabs are preferred so that empty slabs can be released
+	   when they are no longer needed. A new slab is only created once every
+	   existing slab is full. */
+	uintptr_t flags = irq_save();
+	struct kmem_slab *slab = cache->partial;
+	if (!slab && (slab = cache->empty) == NULL) {
+		irq_restore(flags);
+		if ((slab = __kmem_grow(cache)) == NULL) {
+			return NULL;
+		}
+		flags = irq_save();
+		cache->slabs++;
+		__kmem_push(&cache->empty, slab);
+	}
+
+	/* Take the first free object of the slab, and move the slab to the list
+	   that now describes it. Full slabs are not kept in any list. */
+	void *object = slab->free;
+	slab->free = *__kmem_link(cache, object);
+
+	if (slab->inuse++ == 0) {
+		__kmem_remove(&cache->empty, slab);
+		if (slab->free) {
+			__kmem_push(&cache->partial, slab);
+		}
+	}
+	else if (!slab->free) {
+		__kmem_remove(&cache->partial, slab);
+	}
+
+	cache->objects++;
+	irq_restore(flags);
+
+	return object;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *object)
+{
+	if (object == NULL) {
+		klogc(swarn, "Attempted to free NULL to cache %s.\n", cache->name);
+		return;
+	}
+
+	/* Validate that the object belongs to the cache, and is the start of one
+	   of the objects in the slab. */
+	struct kmem_slab *slab = __kmem_slab(cache, object);
+	uint32_t position = (uintptr_t)object - (uintptr_t)slab;
+	if (slab->cache != cache || position < cache->offset
+		|| (position - cache->offset) % cache->stride
+		|| slab->inuse == 0
+	) {
+		klogc(swarn, "Attempted to free %p to the wrong cache %s.\n",
+			object, cache->name);
+		return;
+	}
+
+	uintptr_t flags = irq_save();
+	*__kmem_link(cache, object) = slab->free;
+	slab->free = object;
+	cache->objects--;
+
+	/* A slab that was full now has a free object, and a slab with no more
+	   allocated objects becomes empty. Only a single empty slab is kept, so
+	   that a burst of allocations does not permanently hold memory. */
+	if (slab->inuse-- == cache->capacity) {
+		__kmem_push(&cache->partial, slab);
+	}
+
+	if (slab->inuse == 0) {
+		__kmem_remove(&cache->partial, slab);
+		if (cache->empty) {
+			cache->slabs--;
+			irq_restore(flags);
+			vmm_release_any_pages((uintptr_t)slab, cache->pages);
+			return;
+		}
+		__kmem_push(&cache->empty, slab);
+	}
+
+	irq_restore(flags);
+}
\ No newline at end of file
@@ -0,0 +1,187 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <vmalloc.h>
+#include <slab.h>
+#include <vmm.h>
+#include <vspace.h>
+#include <lock.h>
+#include <print.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+static struct {
+	struct spinlock lock;
+	struct vspace space;
+	struct kmem_cache *cache;
+	struct vmalloc_area *buckets[VMALLOC_BUCKETS];
+	struct vmalloc_stats stats;
+} areas;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline struct vmalloc_area **__vmalloc_bucket(uintptr_t base)
+{
+	return &areas.buckets[(base / PAGE_SIZE) % VMALLOC_BUCKETS];
+}
+
+/* Find the link that refers to the area at _base_, so that the area can also be
+   removed from its chain. Must be called with the lock held. */
+static struct vmalloc_area **__vmalloc_find(uintptr_t base)
+{
+	struct vmalloc_area **link = __vmalloc_bucket(base);
+	while (*link && (*link)->base != base) {
+		link = &(*link)->next;
+	}
+	return link;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+oserr init_vmalloc(void)
+{
+	/* The window is removed from the kernel's linear addresses, and large
+	   allocations are given runs of pages from it instead. */
+	if (vmm_reserve_pages(VMALLOC_BASE, VMALLOC_LIMIT) != e_ok
+		|| init_vspace(&areas.space, VMALLOC_BASE, VMALLOC_LIMIT) != e_ok
+	) {
+		klogc(serr, "Failed to reserve large allocation window %p:%p\n",
+			VMALLOC_BASE, VMALLOC_LIMIT);
+		return e_fail;
+	}
+
+	return e_ok;
+}
+
+void *vmalloc(uint32_t size, uint32_t align)
+{
+	if (size == 0 || (align & (align - 1))) {
+		klogc(swarn, "Bad large allocation of %d bytes (align %d).\n",
+			size, align);
+		return NULL;
+	}
+
+	/* The areas are kept in a cache of their own, rather than on the heap,
+	   so that the heap is never used to track its own large allocations. */
+	spin_lock(&areas.lock);
+	if (!areas.cache) {
+		areas.cache = kmem_cache_create(
+			"vmalloc_area", sizeof(struct vmalloc_area), 0, NULL
+		);
+	}
+	struct vmalloc_area *area = areas.cache
+		? kmem_cache_alloc(areas.cache)
+		: NULL;
+	spin_unlock(&areas.lock);
+	if (!area) {
+		klogc(swarn, "Failed to record a large allocation.\n");
+		return NULL;
+	}
+
+	uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+	uint32_t align_pages = (align > PAGE_SIZE) ? align / PAGE_SIZE : 1;
+	spin_lock(&areas.lock);
+	uintptr_t base = vspace_allocate(&areas.space, pages, align_pages);
+	spin_unlock(&areas.lock);
+
+	uintptr_t limit = base + (pages * PAGE_SIZE);
+	if (base != 0 && vmm_acquire_pages(base, limit) != e_ok) {
+		vmm_release_pages(base, limit);
+		spin_lock(&areas.lock);
+		vspace_release(&areas.space, base, pages);
+		spin_unlock(&areas.lock);
+		base = 0;
+	}
+
+	spin_lock(&areas.lock);
+	if (base == 0) {
+		kmem_cache_free(areas.cache, area);
+		spin_unlock(&areas.lock);
+		klogc(swarn, "Failed to make a large allocation of %d bytes.\n",
+			size);
+		return NULL;
+	}
+
+	struct vmalloc_area **bucket = __vmalloc_bucket(base);
+	area->base = base;
+	area->pages = pages;
+	area->next = *bucket;
+	*bucket = area;
+
+	areas.stats.areas++;
+	areas.stats.pages += pages;
+	spin_unlock(&areas.lock);
+
+	return (void *)base;
+}
+
+void vfree(void *ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+
+	spin_lock(&areas.lock);
+	struct vmalloc_area **link = __vmalloc_find((uintptr_t)ptr);
+	struct vmalloc_area *area = *link;
+	if (!area) {
+		spin_unlock(&areas.lock);
+		klogc(swarn, "Attempted to free an invalid large allocation %p.\n",
+			ptr);
+		return;
+	}
+
+	*link = area->next;
+	uint32_t pages = area->pages;
+	areas.stats.areas--;
+	areas.stats.pages -= pages;
+	kmem_cache_free(areas.cache, area);
+	spin_unlock(&areas.lock);
+
+	uintptr_t base = (uintptr_t)ptr;
+	vmm_release_pages(base, base + (pages * PAGE_SIZE));
+
+	spin_lock(&areas.lock);
+	vspace_release(&areas.space, base, pages);
+	spin_unlock(&areas.lock);
+}
+
+uint32_t vmalloc_size(void *ptr)
+{
+	/* Large allocations always start on a page boundary. */
+	if (ptr == NULL || ((uintptr_t)ptr & (PAGE_SIZE - 1))) {
+		return 0;
+	}
+
+	spin_lock(&areas.lock);
+	struct vmalloc_area *area = *__vmalloc_find((uintptr_t)ptr);
+	uint32_t size = area ? area->pages * PAGE_SIZE : 0;
+	spin_unlock(&areas.lock);
+	return size;
+}
+
+void vmalloc_get_stats(struct vmalloc_stats *stats)
+{
+	spin_lock(&areas.lock);
+	*stats = areas.stats;
+	spin_unlock(&areas.lock);
+}
\ No newline at end of file
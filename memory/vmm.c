@@ -21,10 +21,51 @@
  */
 
 #include <vmm.h>
+#include <vspace.h>
 #include <pmm.h>
 #include <paging.h>
 #include <print.h>
 #include <string.h>
+#include <arch.h>
+#include <reclaim.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define VMM_ZERO_POOL_SIZE	64
+
+/* Runs of pages are backed by physically contiguous blocks of up to 2^order
+   frames, so that they can be mapped with a single pass over the page table. */
+#define VMM_RUN_ORDER		4
+
+/* Linear addresses that are handed out by the VMM are taken from the kernel's
+   region of the address space. The first page is never used. */
+#define VMM_KERNEL_BASE		0x00001000
+#define VMM_KERNEL_LIMIT	0x40000000
+
+#define VMM_MAX_REGIONS		16
+
+static struct {
+	paddr_t frames[VMM_ZERO_POOL_SIZE];
+	uint32_t count;
+	uint32_t hits;
+	uint32_t misses;
+} zero_pool;
+
+/* Pages of demand paged regions that have only ever been read all map this
+   frame, which is never written to. */
+static paddr_t zero_frame = 0;
+static uint32_t zero_page_mappings = 0;
+
+/* Linear addresses are only ever handed out from kernel memory, which is
+   shared by every context, so that a run of pages remains valid whichever
+   context is active. The private memory of a context belongs entirely to its
+   heap, so no context has a space of its own. */
+static struct vspace kernel_vspace;
+
+static struct {
+	struct vmm_region region[VMM_MAX_REGIONS];
+	uint32_t count;
+} regions;
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -34,6 +75,65 @@ static inline void *__vmm_current_context(void)
 	return kernel_paging_ctx;
 }
 
+/* Reserve every page in the range that is already mapped, so that it is never
+   handed out again. This is only needed once, when the space is created. */
+static void __vmm_reserve_mapped(
+	void *ctx, struct vspace *space, uintptr_t base, uintptr_t limit
+) {
+	uintptr_t linear = base;
+	while (linear < limit) {
+		uint32_t pages = (limit - linear) / PAGE_SIZE;
+		linear += paging_count_unmapped(ctx, linear, pages) * PAGE_SIZE;
+
+		uintptr_t start = linear;
+		while (linear < limit && page_is_mapped(ctx, linear)) {
+			linear += PAGE_SIZE;
+		}
+		if (linear > start) {
+			vspace_reserve(space, start, (linear - start) / PAGE_SIZE);
+		}
+	}
+}
+
+static struct vmm_region *__vmm_find_region(uintptr_t linear)
+{
+	for (uint32_t i = 0; i < regions.count; ++i) {
+		if (linear >= regions.region[i].base 
+			&& linear < regions.region[i].limit
+		) {
+			return &regions.region[i];
+		}
+	}
+	return NULL;
+}
+
+static bool __vmm_handle_fault(uintptr_t linear, bool write)
+{
+	/* Only faults within a demand paged region can be resolved. */
+	struct vmm_region *region = __vmm_find_region(linear);
+	if (!region) {
+		return false;
+	}
+
+	/* Reads are satisfied by the zero page until the page is first written,
+	   at which point it receives a frame of its own. */
+	linear &= ~(PAGE_SIZE - 1);
+	if (!write && !vmm_address_valid(linear)) {
+		if (paging_map_readonly(__vmm_current_context(), zero_frame, linear)
+			!= e_ok
+		) {
+			return false;
+		}
+		zero_page_mappings++;
+	}
+	else if (!write || vmm_acquire_page(linear) != e_ok) {
+		return false;
+	}
+
+	region->faults++;
+	return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 oserr init_virtual_memory(void)
@@ -47,6 +147,31 @@ oserr init_virtual_memory(void)
 		return e_fail;
 	}
 
+	/* Construct the virtual space of the kernel. Anything that paging has
+	   already mapped, along with the page table window, must be excluded. */
+	uintptr_t start, end;
+	struct vspace *space = &kernel_vspace;
+	if (init_vspace(space, VMM_KERNEL_BASE, VMM_KERNEL_LIMIT) != e_ok) {
+		klogc(serr, "Failed to create the kernel virtual space.\n");
+		return e_fail;
+	}
+	__vmm_reserve_mapped(
+		__vmm_current_context(), space, VMM_KERNEL_BASE, VMM_KERNEL_LIMIT
+	);
+	paging_window_range(&start, &end);
+	vspace_reserve(space, start, (end - start) / PAGE_SIZE);
+
+	/* Pages in demand paged regions are acquired by the page fault handler.
+	   The zero page is shared by all of them, so must never be released. */
+	zero_frame = pmm_acquire_frame();
+	pmm_set_frame_flags(zero_frame, frame_pinned);
+	uintptr_t flags = irq_save();
+	void *page = (void *)paging_map_temporary(paging_slot_zero, zero_frame);
+	memset(page, 0, PAGE_SIZE);
+	paging_unmap_temporary(paging_slot_zero);
+	irq_restore(flags);
+	paging_set_fault_handler(__vmm_handle_fault);
+
 	if (vmm_acquire_page(0x01000000) == e_fail) {
 		klogc(serr, "Failed to acquire 0x01000000 (1)\n");
 	}
@@ -66,46 +191,311 @@ bool vmm_address_valid(uintptr_t address)
 	return page_is_mapped(__vmm_current_context(), address);
 }
 
+bool vmm_page_is_zero(uintptr_t linear)
+{
+	/* A page in a demand paged region that has not been acquired will be
+	   zero filled when it is first accessed. */
+	paddr_t frame = 0;
+	void *ctx = __vmm_current_context();
+	linear &= ~(PAGE_SIZE - 1);
+	if (paging_linear_to_phys(ctx, linear, &frame) != e_ok) {
+		return __vmm_find_region(linear) != NULL;
+	}
+	return zero_frame != 0 && frame == zero_frame;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 uintptr_t vmm_acquire_any_page(void)
 {
-	/* Find the first available linear address in the current context. */
-	uintptr_t linear = paging_find_linear(__vmm_current_context());
+	return vmm_acquire_any_pages(1, 1);
+}
+
+uintptr_t vmm_acquire_any_pages(uint32_t count, uint32_t align)
+{
+	/* Find the lowest free run of linear addresses in the current context. */
+	struct vspace *space = &kernel_vspace;
+	uintptr_t flags = irq_save();
+	uintptr_t linear = vspace_allocate(space, count, align);
+	irq_restore(flags);
+	if (linear == 0) {
+		klogc(serr, "No free linear addresses for %d pages\n", count);
+		return 0;
+	}
 
-	/* Attempt to acquire the page. If it fails then return NULL. */
-	if (vmm_acquire_page(linear) != e_ok) {
+	/* Attempt to acquire the pages. If it fails then return NULL. */
+	oserr err = (count == 1)
+		? vmm_acquire_page(linear)
+		: vmm_acquire_pages(linear, linear + (count * PAGE_SIZE));
+	if (err != e_ok) {
+		vmm_release_any_pages(linear, count);
 		return 0;
 	}
 
-	/* Page acquired successfully. Return its linear address. */
+	/* Pages acquired successfully. Return the linear address of the first. */
+	return linear;
+}
+
+uintptr_t vmm_map_frames(const paddr_t *frames, uint32_t count)
+{
+	struct vspace *space = &kernel_vspace;
+	uintptr_t flags = irq_save();
+	uintptr_t linear = vspace_allocate(space, count, 1);
+	irq_restore(flags);
+
+	void *ctx = __vmm_current_context();
+	for (uint32_t i = 0; i < count; ++i) {
+		uintptr_t page = linear + (i * PAGE_SIZE);
+		if (linear == 0 || paging_map(ctx, frames[i], page) != e_ok) {
+			/* The frames that were not mapped are released directly, and
+			   those that were are released with the pages. */
+			klogc(serr, "Failed to map %d frames\n", count);
+			for (uint32_t j = i; j < count; ++j) {
+				pmm_release_frame(frames[j]);
+			}
+			if (linear != 0) {
+				vmm_release_pages(linear, page);
+				flags = irq_save();
+				vspace_release(space, linear, count);
+				irq_restore(flags);
+			}
+			return 0;
+		}
+	}
+
 	return linear;
 }
 
+oserr vmm_release_any_pages(uintptr_t linear, uint32_t count)
+{
+	if (vmm_release_pages(linear, linear + (count * PAGE_SIZE)) != e_ok) {
+		return e_fail;
+	}
+
+	struct vspace *space = &kernel_vspace;
+	uintptr_t flags = irq_save();
+	oserr err = vspace_release(space, linear, count);
+	irq_restore(flags);
+	return err;
+}
+
+oserr vmm_reserve_pages(uintptr_t first, uintptr_t last)
+{
+	/* Make sure the linear address is aligned, or we will end up with errors */
+	first &= ~(PAGE_SIZE - 1);
+
+	struct vspace *space = &kernel_vspace;
+	uintptr_t flags = irq_save();
+	oserr err = vspace_reserve(
+		space, first, (last - first + PAGE_SIZE - 1) / PAGE_SIZE
+	);
+	irq_restore(flags);
+	return err;
+}
+
+oserr vmm_create_region(const char *name, uintptr_t base, uintptr_t limit)
+{
+	if ((base & (PAGE_SIZE - 1)) || (limit & (PAGE_SIZE - 1)) 
+		|| base >= limit
+	) {
+		klogc(serr, "Region %s is not aligned (%p:%p)\n", name, base, limit);
+		return e_fail;
+	}
+	else if (vmm_reserve_pages(base, limit) != e_ok) {
+		return e_fail;
+	}
+
+	/* Every context places its heap at the same location in its private
+	   memory, so an identical region is shared by all of them. */
+	uintptr_t flags = irq_save();
+	for (uint32_t i = 0; i < regions.count; ++i) {
+		if (regions.region[i].base == base 
+			&& regions.region[i].limit == limit
+		) {
+			irq_restore(flags);
+			return e_ok;
+		}
+	}
+
+	if (regions.count >= VMM_MAX_REGIONS) {
+		irq_restore(flags);
+		klogc(serr, "Too many demand paged regions for %s\n", name);
+		return e_fail;
+	}
+
+	struct vmm_region *region = &regions.region[regions.count++];
+	region->name = name;
+	region->base = base;
+	region->limit = limit;
+	region->faults = 0;
+	irq_restore(flags);
+
+	return e_ok;
+}
+
+const struct vmm_region *vmm_get_region(uint32_t index)
+{
+	return (index < regions.count) ? &regions.region[index] : NULL;
+}
+
 oserr vmm_acquire_page(uintptr_t linear)
 {
 	/* Make sure the linear address is aligned, or we will end up with errors */
 	linear &= ~(PAGE_SIZE - 1);
 
+	/* A page that is mapped to the zero page has not really been acquired
+	   yet, and needs a frame of its own. */
+	paddr_t current = 0;
+	void *ctx = __vmm_current_context();
+	if (zero_frame != 0
+		&& paging_linear_to_phys(ctx, linear, &current) == e_ok
+		&& current == zero_frame
+		&& paging_unmap(ctx, linear) != e_ok
+	) {
+		klogc(serr, "Failed to replace zero page at %p\n", linear);
+		return e_fail;
+	}
+
 	/* Acquire a physical frame from the PMM and map it to the above linear
 	   address. */
 
 	if (!vmm_address_valid(linear)) {
-		void *ctx = __vmm_current_context();
-		uintptr_t frame = pmm_acquire_frame();
+		/* Prefer a frame that has already been zeroed. Otherwise the page will
+		   need to be cleared once it has been mapped. Where frames are colored,
+		   the page is given a frame of the same color as its linear address so
+		   that neighbouring pages do not compete for the same cache sets. */
+		uint32_t color = linear / PAGE_SIZE;
+		uintptr_t flags = irq_save();
+		paddr_t frame = 0;
+		if (zero_pool.count > 0) {
+			uint32_t i = zero_pool.count - 1;
+			uint32_t colors = pmm_frame_colors();
+			for (uint32_t j = 0; colors > 1 && j < zero_pool.count; ++j) {
+				if (pmm_frame_color(zero_pool.frames[j])
+					== (color & (colors - 1))
+				) {
+					i = j;
+					break;
+				}
+			}
+			frame = zero_pool.frames[i];
+			zero_pool.frames[i] = zero_pool.frames[--zero_pool.count];
+			zero_pool.hits++;
+		}
+		else {
+			zero_pool.misses++;
+		}
+		irq_restore(flags);
+
+		bool zeroed = (frame != 0);
+		if (!zeroed) {
+			frame = pmm_acquire_colored_frame(color);
+		}
+
 		if (paging_map(ctx, frame, linear) != e_ok){
 			klogc(serr, "Failed to acquire page %p\n", linear);
+			pmm_release_frame(frame);
 			return e_fail;
 		}
 
 		/* Clear the contents of the page */
-		memset((void *)linear, 0, PAGE_SIZE);
+		if (!zeroed) {
+			memset((void *)linear, 0, PAGE_SIZE);
+		}
 	}
 	
 	/* Acquired the page successfully */
 	return e_ok;
 }
 
+static oserr __vmm_acquire_large_page(void *ctx, uintptr_t linear)
+{
+	if (!paging_large_page_available(ctx, linear)) {
+		return e_fail;
+	}
+
+	/* The block must be aligned to the size of a large page. If memory is too
+	   fragmented for that then the caller falls back to regular pages. */
+	uint32_t order = paging_large_page_order();
+	paddr_t frame = pmm_acquire_frames(order, FRAME_SIZE << order);
+	if (frame == 0) {
+		return e_fail;
+	}
+
+	if (paging_map_large(ctx, frame, linear) != e_ok) {
+		pmm_release_frames(frame, order);
+		return e_fail;
+	}
+
+	memset((void *)linear, 0, FRAME_SIZE << order);
+	return e_ok;
+}
+
+oserr vmm_acquire_pages(uintptr_t first, uintptr_t last)
+{
+	/* Make sure the linear address is aligned, or we will end up with errors */
+	first &= ~(PAGE_SIZE - 1);
+
+	void *ctx = __vmm_current_context();
+	uintptr_t large_size = FRAME_SIZE << paging_large_page_order();
+	uintptr_t addr = first;
+	while (addr < last) {
+		/* Cover entire large pages with a single mapping where possible. */
+		if ((last - addr) >= large_size
+			&& __vmm_acquire_large_page(ctx, addr) == e_ok
+		) {
+			addr += large_size;
+			continue;
+		}
+
+		/* Find out how much of the range is not yet mapped. Single pages are
+		   left to the regular path, so that they can use the zero pool. */
+		uint32_t run = paging_count_unmapped(
+			ctx, addr, (last - addr + PAGE_SIZE - 1) / PAGE_SIZE
+		);
+		if (run <= 1) {
+			if (vmm_acquire_page(addr) != e_ok) {
+				return e_fail;
+			}
+			addr += PAGE_SIZE;
+			continue;
+		}
+
+		while (run > 0) {
+			uint32_t order = VMM_RUN_ORDER;
+			while ((1U << order) > run) {
+				--order;
+			}
+
+			paddr_t frame;
+			while ((frame = pmm_acquire_frames(order, 0)) == 0 && order > 0) {
+				--order;
+			}
+			if (frame == 0) {
+				klogc(serr, "Failed to acquire pages at %p\n", addr);
+				return e_fail;
+			}
+
+			/* Each page must be releasable on its own later. */
+			uint32_t count = 1 << order;
+			if (order > 0) {
+				pmm_split_frames(frame, order);
+			}
+
+			if (paging_map_range(ctx, frame, addr, count) != e_ok) {
+				klogc(serr, "Failed to map pages at %p\n", addr);
+				return e_fail;
+			}
+			memset((void *)addr, 0, count * PAGE_SIZE);
+
+			addr += count * PAGE_SIZE;
+			run -= count;
+		}
+	}
+
+	return e_ok;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 oserr vmm_release_pages(uintptr_t first, uintptr_t last)
@@ -114,20 +504,40 @@ oserr vmm_release_pages(uintptr_t first, uintptr_t last)
 	first &= ~(PAGE_SIZE - 1);
 	last &= ~(PAGE_SIZE - 1);
 
+	/* The range is unmapped in a single pass, which takes care of any
+	   invalidation that is required. */
 	void *ctx = __vmm_current_context();
-	for (uintptr_t addr = first; addr < last; addr += PAGE_SIZE) {
-		if (paging_unmap(ctx, addr) != e_ok) {
-			klogc(serr, "Failed to unmap page %p\n", addr);
+	if (last > first) {
+		uint32_t count = (last - first) / PAGE_SIZE;
+		if (paging_unmap_range(ctx, first, count) != e_ok) {
+			klogc(serr, "Failed to unmap pages %p-%p\n", first, last);
 			return e_fail;
 		}
 	}
 
-	/* Make sure any page caches are removed/invalidated */
-	paging_flush();
-
 	return e_ok;
 }
 
+uint32_t vmm_count_acquired(uintptr_t first, uintptr_t last)
+{
+	first &= ~(PAGE_SIZE - 1);
+	last &= ~(PAGE_SIZE - 1);
+
+	/* Runs of unmapped pages are skipped a table at a time where possible. */
+	void *ctx = __vmm_current_context();
+	uint32_t count = 0;
+	while (first < last) {
+		uint32_t remaining = (last - first) / PAGE_SIZE;
+		first += paging_count_unmapped(ctx, first, remaining) * PAGE_SIZE;
+		if (first < last) {
+			count++;
+			first += PAGE_SIZE;
+		}
+	}
+
+	return count;
+}
+
 oserr vmm_release_page(uintptr_t linear)
 {
 	/* Make sure the linear address is aligned, or we will end up with errors */
@@ -139,8 +549,53 @@ oserr vmm_release_page(uintptr_t linear)
 		return e_fail;
 	}
 
-	/* Make sure any page caches are removed/invalidated */
-	paging_flush();
-
 	return e_ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool vmm_prepare_zeroed_frame(void)
+{
+	/* The pool is shared with any thread acquiring pages, and the temporary
+	   mapping slot can only be used by one caller at a time. Keep interrupts
+	   disabled whilst the frame is cleared. */
+	uintptr_t flags = irq_save();
+	if (zero_pool.count >= VMM_ZERO_POOL_SIZE || reclaim_pressure()) {
+		irq_restore(flags);
+		return false;
+	}
+
+	paddr_t frame = pmm_acquire_colored_frame(PMM_COLOR_DIVERSE);
+	void *page = (void *)paging_map_temporary(paging_slot_zero, frame);
+	memset(page, 0, PAGE_SIZE);
+	paging_unmap_temporary(paging_slot_zero);
+
+	zero_pool.frames[zero_pool.count++] = frame;
+	irq_restore(flags);
+
+	return true;
+}
+
+uint32_t vmm_release_zeroed_frames(uint32_t count)
+{
+	uintptr_t flags = irq_save();
+	uint32_t released = 0;
+	while (released < count && zero_pool.count > 0) {
+		pmm_release_frame(zero_pool.frames[--zero_pool.count]);
+		released++;
+	}
+	irq_restore(flags);
+	return released;
+}
+
+void vmm_get_stats(struct vmm_stats *stats)
+{
+	if (!stats) {
+		return;
+	}
+
+	stats->zero_pool_frames = zero_pool.count;
+	stats->zero_pool_hits = zero_pool.hits;
+	stats->zero_pool_misses = zero_pool.misses;
+	stats->zero_page_mappings = zero_page_mappings;
 }
\ No newline at end of file
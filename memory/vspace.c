@@ -0,0 +1,450 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+#include <vspace.h>
+#include <vmm.h>
+#include <print.h>
+#include <string.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define VSPACE_PAGE_SHIFT	12
+
+/* Enough spare extents must be available before any operation begins that no
+   operation ever needs to find more part way through. */
+#define VSPACE_MIN_SPARES	2
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline int32_t __vspace_height(struct vspace_extent *extent)
+{
+	return extent ? extent->height : 0;
+}
+
+static inline uint32_t __vspace_largest(struct vspace_extent *extent)
+{
+	return extent ? extent->largest : 0;
+}
+
+static inline uint32_t __vspace_end(struct vspace_extent *extent)
+{
+	return extent->first + extent->pages;
+}
+
+static void __vspace_update(struct vspace_extent *extent)
+{
+	int32_t left = __vspace_height(extent->left);
+	int32_t right = __vspace_height(extent->right);
+	extent->height = 1 + MAX(left, right);
+
+	uint32_t largest = MAX(
+		__vspace_largest(extent->left), __vspace_largest(extent->right)
+	);
+	extent->largest = MAX(largest, extent->pages);
+}
+
+static struct vspace_extent *__vspace_rotate_left(struct vspace_extent *extent)
+{
+	struct vspace_extent *pivot = extent->right;
+	extent->right = pivot->left;
+	pivot->left = extent;
+	__vspace_update(extent);
+	__vspace_update(pivot);
+	return pivot;
+}
+
+static struct vspace_extent *__vspace_rotate_right(struct vspace_extent *extent)
+{
+	struct vspace_extent *pivot = extent->left;
+	extent->left = pivot->right;
+	pivot->right = extent;
+	__vspace_update(extent);
+	__vspace_update(pivot);
+	return pivot;
+}
+
+static struct vspace_extent *__vspace_balance(struct vspace_extent *extent)
+{
+	__vspace_update(extent);
+	int32_t balance = 
+		__vspace_height(extent->left) - __vspace_height(extent->right);
+
+	if (balance > 1) {
+		if (__vspace_height(extent->left->left) 
+			< __vspace_height(extent->left->right)
+		) {
+			extent->left = __vspace_rotate_left(extent->left);
+		}
+		return __vspace_rotate_right(extent);
+	}
+	else if (balance < -1) {
+		if (__vspace_height(extent->right->right) 
+			< __vspace_height(extent->right->left)
+		) {
+			extent->right = __vspace_rotate_right(extent->right);
+		}
+		return __vspace_rotate_left(extent);
+	}
+
+	return extent;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static struct vspace_extent *__vspace_insert(
+	struct vspace_extent *root, struct vspace_extent *extent
+) {
+	if (!root) {
+		extent->left = extent->right = NULL;
+		__vspace_update(extent);
+		return extent;
+	}
+	else if (extent->first < root->first) {
+		root->left = __vspace_insert(root->left, extent);
+	}
+	else {
+		root->right = __vspace_insert(root->right, extent);
+	}
+	return __vspace_balance(root);
+}
+
+static struct vspace_extent *__vspace_remove_lowest(
+	struct vspace_extent *root, struct vspace_extent **lowest
+) {
+	if (!root->left) {
+		*lowest = root;
+		return root->right;
+	}
+	root->left = __vspace_remove_lowest(root->left, lowest);
+	return __vspace_balance(root);
+}
+
+static struct vspace_extent *__vspace_remove(
+	struct vspace_extent *root, struct vspace_extent *extent
+) {
+	if (!root) {
+		return NULL;
+	}
+	else if (extent->first < root->first) {
+		root->left = __vspace_remove(root->left, extent);
+	}
+	else if (extent->first > root->first) {
+		root->right = __vspace_remove(root->right, extent);
+	}
+	else if (!root->left || !root->right) {
+		return root->left ? root->left : root->right;
+	}
+	else {
+		/* Replace the extent with the lowest extent above it. */
+		struct vspace_extent *successor = NULL;
+		struct vspace_extent *right = __vspace_remove_lowest(
+			root->right, &successor
+		);
+		successor->left = root->left;
+		successor->right = right;
+		root = successor;
+	}
+	return __vspace_balance(root);
+}
+
+/* Recalculate the extents on the path to _extent_ after its size or first page
+   has changed. The order of the tree must not have been affected. */
+static void __vspace_refresh(
+	struct vspace_extent *root, struct vspace_extent *extent
+) {
+	if (!root) {
+		return;
+	}
+	else if (extent->first < root->first) {
+		__vspace_refresh(root->left, extent);
+	}
+	else if (extent->first > root->first) {
+		__vspace_refresh(root->right, extent);
+	}
+	__vspace_update(root);
+}
+
+/* Find the extent with the highest first page no greater than _page_. */
+static struct vspace_extent *__vspace_floor(
+	struct vspace_extent *root, uint32_t page
+) {
+	struct vspace_extent *found = NULL;
+	while (root) {
+		if (root->first <= page) {
+			found = root;
+			root = root->right;
+		}
+		else {
+			root = root->left;
+		}
+	}
+	return found;
+}
+
+/* Find the extent with the lowest first page no less than _page_. */
+static struct vspace_extent *__vspace_ceiling(
+	struct vspace_extent *root, uint32_t page
+) {
+	struct vspace_extent *found = NULL;
+	while (root) {
+		if (root->first >= page) {
+			found = root;
+			root = root->left;
+		}
+		else {
+			root = root->right;
+		}
+	}
+	return found;
+}
+
+/* Find the lowest extent that has at least _pages_ free pages. */
+static struct vspace_extent *__vspace_first_fit(
+	struct vspace_extent *root, uint32_t pages
+) {
+	while (root && root->largest >= pages) {
+		if (__vspace_largest(root->left) >= pages) {
+			root = root->left;
+		}
+		else if (root->pages >= pages) {
+			return root;
+		}
+		else {
+			root = root->right;
+		}
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static struct vspace_extent *__vspace_new_extent(
+	struct vspace *space, uint32_t first, uint32_t pages
+) {
+	struct vspace_extent *extent = space->spare;
+	space->spare = extent->right;
+	space->spares--;
+
+	extent->first = first;
+	extent->pages = pages;
+	return extent;
+}
+
+static void __vspace_free_extent(
+	struct vspace *space, struct vspace_extent *extent
+) {
+	extent->right = space->spare;
+	space->spare = extent;
+	space->spares++;
+}
+
+/* Remove the pages from _first_ up to _end_ from _extent_, which must contain
+   all of them. */
+static void __vspace_carve(
+	struct vspace *space, struct vspace_extent *extent, uint32_t first,
+	uint32_t end
+) {
+	uint32_t extent_end = __vspace_end(extent);
+	space->pages -= (end - first);
+
+	if (extent->first == first && extent_end == end) {
+		space->root = __vspace_remove(space->root, extent);
+		__vspace_free_extent(space, extent);
+	}
+	else if (extent->first == first) {
+		extent->first = end;
+		extent->pages = extent_end - end;
+		__vspace_refresh(space->root, extent);
+	}
+	else {
+		extent->pages = first - extent->first;
+		__vspace_refresh(space->root, extent);
+
+		if (extent_end > end) {
+			space->root = __vspace_insert(
+				space->root, __vspace_new_extent(space, end, extent_end - end)
+			);
+		}
+	}
+}
+
+static oserr __vspace_refill(struct vspace *space)
+{
+	if (space->spares >= VSPACE_MIN_SPARES) {
+		return e_ok;
+	}
+
+	/* Take the lowest free page of the space for the new extents. Removing a
+	   page from the start of an extent never requires another extent. */
+	struct vspace_extent *extent = __vspace_first_fit(space->root, 1);
+	if (!extent) {
+		klogc(serr, "Virtual space has no room for more extents.\n");
+		return e_fail;
+	}
+
+	uint32_t page = extent->first;
+	uintptr_t linear = (uintptr_t)page << VSPACE_PAGE_SHIFT;
+	__vspace_carve(space, extent, page, page + 1);
+	if (vmm_acquire_page(linear) != e_ok) {
+		klogc(serr, "Failed to acquire page for virtual space extents.\n");
+		return e_fail;
+	}
+
+	struct vspace_extent *extents = (void *)linear;
+	uint32_t count = (1 << VSPACE_PAGE_SHIFT) / sizeof(*extents);
+	for (uint32_t i = 0; i < count; ++i) {
+		__vspace_free_extent(space, &extents[i]);
+	}
+
+	return e_ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+oserr init_vspace(struct vspace *space, uintptr_t base, uintptr_t limit)
+{
+	if (!space || (base >> VSPACE_PAGE_SHIFT) >= (limit >> VSPACE_PAGE_SHIFT)) {
+		klogc(serr, "Invalid virtual space %p:%p\n", base, limit);
+		return e_fail;
+	}
+
+	memset(space, 0, sizeof(*space));
+	space->first = base >> VSPACE_PAGE_SHIFT;
+	space->limit = limit >> VSPACE_PAGE_SHIFT;
+
+	for (uint32_t i = 0; i < VSPACE_INITIAL_EXTENTS; ++i) {
+		__vspace_free_extent(space, &space->initial[i]);
+	}
+
+	/* The entire space starts out as a single free extent. */
+	space->pages = space->limit - space->first;
+	space->root = __vspace_insert(
+		NULL, __vspace_new_extent(space, space->first, space->pages)
+	);
+
+	return e_ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uintptr_t vspace_allocate(struct vspace *space, uint32_t count, uint32_t align)
+{
+	if (count == 0 || align == 0 || (align & (align - 1))) {
+		klogc(swarn, "Invalid virtual allocation (%d:%d)\n", count, align);
+		return 0;
+	}
+	else if (__vspace_refill(space) != e_ok) {
+		return 0;
+	}
+
+	/* Any extent of this size is guaranteed to contain an aligned run. */
+	struct vspace_extent *extent = __vspace_first_fit(
+		space->root, count + (align - 1)
+	);
+	if (!extent) {
+		return 0;
+	}
+
+	uint32_t first = (extent->first + (align - 1)) & ~(align - 1);
+	__vspace_carve(space, extent, first, first + count);
+	return (uintptr_t)first << VSPACE_PAGE_SHIFT;
+}
+
+oserr vspace_release(struct vspace *space, uintptr_t linear, uint32_t count)
+{
+	uint32_t first = linear >> VSPACE_PAGE_SHIFT;
+	uint32_t end = first + count;
+	if (first < space->first || end > space->limit || end <= first) {
+		klogc(swarn, "Virtual space does not contain %p (%d)\n", linear, count);
+		return e_fail;
+	}
+	else if (__vspace_refill(space) != e_ok) {
+		return e_fail;
+	}
+
+	/* The run must not overlap any free extent. */
+	struct vspace_extent *before = __vspace_floor(space->root, first);
+	struct vspace_extent *after = __vspace_ceiling(space->root, first);
+	if ((before && __vspace_end(before) > first) 
+		|| (after && after->first < end)
+	) {
+		klogc(swarn, "Virtual pages %p (%d) are already free\n", linear, count);
+		return e_fail;
+	}
+
+	/* Merge the run with the neighbouring extents where possible. */
+	space->pages += count;
+	if (before && __vspace_end(before) == first) {
+		before->pages += count;
+		if (after && after->first == end) {
+			before->pages += after->pages;
+			space->root = __vspace_remove(space->root, after);
+			__vspace_free_extent(space, after);
+		}
+		__vspace_refresh(space->root, before);
+	}
+	else if (after && after->first == end) {
+		after->first = first;
+		after->pages += count;
+		__vspace_refresh(space->root, after);
+	}
+	else {
+		space->root = __vspace_insert(
+			space->root, __vspace_new_extent(space, first, count)
+		);
+	}
+
+	return e_ok;
+}
+
+oserr vspace_reserve(struct vspace *space, uintptr_t linear, uint32_t count)
+{
+	uint32_t first = MAX(linear >> VSPACE_PAGE_SHIFT, space->first);
+	uint32_t end = MIN((linear >> VSPACE_PAGE_SHIFT) + count, space->limit);
+	if (__vspace_refill(space) != e_ok) {
+		return e_fail;
+	}
+
+	/* Only the first overlapping extent can need splitting in two, so at most
+	   one spare extent is needed. */
+	while (first < end) {
+		struct vspace_extent *extent = __vspace_floor(space->root, first);
+		if (!extent || __vspace_end(extent) <= first) {
+			extent = __vspace_ceiling(space->root, first);
+		}
+		if (!extent || extent->first >= end) {
+			break;
+		}
+
+		uint32_t carve_first = MAX(first, extent->first);
+		uint32_t carve_end = MIN(end, __vspace_end(extent));
+		__vspace_carve(space, extent, carve_first, carve_end);
+		first = carve_end;
+	}
+
+	return e_ok;
+}
+
+uint32_t vspace_free_pages(struct vspace *space)
+{
+	return space->pages;
+}
\ No newline at end of file
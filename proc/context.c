@@ -26,6 +26,7 @@
 #include <print.h>
 #include <vmm.h>
 #include <paging.h>
+#include <vmalloc.h>
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -67,7 +68,7 @@ oserr init_context(struct context **ctx)
 	/* We need to produce a new paging context. Fetch the kernel paging context
 	   for now as we'll need to clone it and work from there. */
 	struct paging_context *paging_ctx = NULL;
-	uintptr_t heap_base = 0x10000000;
+	uintptr_t heap_base = 0x40000000; /* 1GiB, the start of private memory */
 	uintptr_t heap_limit = 0xC0000000;
 	if (*ctx == kernel_context) {
 		/* We're setting up the kernel context. For this we do not need to
@@ -75,11 +76,20 @@ oserr init_context(struct context **ctx)
 		   so that it operates within "kernel" memory. */
 		paging_ctx = kernel_paging_ctx;
 		heap_base = 0x01000000; /* 16MiB */
-		heap_limit = 0x40000000; /* 1GiB */
+		heap_limit = VMALLOC_BASE; /* The rest is for large allocations */
 		klog("Using existing Kernel Page Context: %p\n", kernel_paging_ctx);
 	}
 	else {
-		
+		/* Any other context starts as a copy of the current one. Its pages are
+		   shared until one of the contexts writes to them. */
+		void *parent = __current_context
+			? __current_context->paging_context
+			: kernel_paging_ctx;
+		paging_ctx = paging_clone_context(parent);
+		if (!paging_ctx) {
+			klogc(serr, "Failed to clone paging context %p\n", parent);
+			return e_fail;
+		}
 	}
 
 	/* The first job is to construct a header frame for the context. We need 
@@ -91,8 +101,25 @@ oserr init_context(struct context **ctx)
 	*ctx = header;
 	(*ctx)->paging_context = paging_ctx;
 
-	/* Initialise the heap for the context */
-	init_heap(&header->ctx_heap, heap_base, heap_limit);
+	/* Initialise the heap for the context. The heap is in the private memory
+	   of the context, so the context must be active whilst doing so. */
+	void *previous = __current_context
+		? __current_context->paging_context
+		: kernel_paging_ctx;
+	if (paging_ctx != previous) {
+		paging_set_context(paging_ctx);
+	}
+
+	/* A context cloned from another private context holds a copy of every
+	   page of its parent's heap, including the heap's own structures. It
+	   keeps using that heap, which accounts for every one of those pages,
+	   rather than building a new heap over the top of them. */
+	if (previous != kernel_paging_ctx && paging_ctx != kernel_paging_ctx) {
+		header->ctx_heap = __current_context->heap;
+	}
+	else {
+		init_heap(&header->ctx_heap, heap_base, heap_limit);
+	}
 	(*ctx)->heap = header->ctx_heap;
 
 	/* Setup a stack for the context. If this is the Kernel context then we
@@ -108,11 +135,21 @@ oserr init_context(struct context **ctx)
 		(*ctx)->stack = heap_alloc((*ctx)->heap, (*ctx)->stack_size);
 		if (init_stack((*ctx)->stack, NULL, &sp) != e_ok) {
 			kprintc(serr, "Failed to setup stack for context.\n");
+			if (paging_ctx != previous) {
+				paging_set_context(previous);
+			}
+			paging_release_context(paging_ctx);
+			vmm_release_any_pages((uintptr_t)header, 1);
+			*ctx = NULL;
 			return e_fail;
 		}
 		(*ctx)->stack_ptr = (void *)sp;
 	}
 
+	if (paging_ctx != previous) {
+		paging_set_context(previous);
+	}
+
 	/* The context should now be established and ready for use. The last thing
 	   to do is ensure there is an active context. Make this context the active
 	   one if there isn't already one. */
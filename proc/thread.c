@@ -25,6 +25,8 @@
 #include <print.h>
 #include <stack.h>
 #include <heap.h>
+#include <vmm.h>
+#include <slab.h>
 #include <arch.h>
 #include <time.h>
 #include <keyboard.h>
@@ -51,6 +53,7 @@ static struct thread _kernel_main = {
 struct thread *kernel_main_thread = &_kernel_main;
 static struct thread *_current_thread;
 static uint32_t next_tid = INITIAL_TID;
+static struct kmem_cache *thread_cache = NULL;
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -105,21 +108,40 @@ oserr init_threading(void)
 	kernel_main_thread->next = kernel_main_thread;
 	_current_thread = kernel_main_thread;
 
+	/* Threads are switched between often, so each is kept on its own cache
+	   lines. */
+	thread_cache = kmem_cache_create(
+		"thread", sizeof(struct thread), KMEM_CACHE_LINE, NULL
+	);
+	if (!thread_cache) {
+		return e_fail;
+	}
+
 	return e_ok;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+struct thread *current_thread(void)
+{
+	return _current_thread;
+}
+
 struct thread *thread_create(int(*start)(void))
 {
 	/* Setup the new thread instance */
-	struct thread *thread = kalloc(sizeof(*thread));
+	struct thread *thread = kmem_cache_alloc(thread_cache);
 	thread->tid = next_tid++;
 	thread->start = start;
 	thread->state = thread_running;
+	kalloc_init_cache(&thread->allocs);
 
-	/* Setup the thread stack. */
-	thread->stack = kalloc(THREAD_STACK_SIZE);
+	/* Setup the thread stack. This is not taken from the heap, as the pages
+	   of the heap are only acquired when first accessed. A fault on the stack
+	   can not be handled, as the processor needs the stack to report it. */
+	thread->stack = (void *)vmm_acquire_any_pages(
+		THREAD_STACK_SIZE / PAGE_SIZE, 1
+	);
 	thread->stack_base = thread->stack + THREAD_STACK_SIZE;
 	if (init_stack(thread->stack_base, start, &thread->stack) != e_ok) {
 		klogc(swarn, "Failed to setup thread stack correctly.\n");
@@ -23,10 +23,17 @@
 #include <tar.h>
 #include <types.h>
 #include <alloc.h>
+#include <slab.h>
 #include <print.h>
 
 ////////////////////////////////////////////////////////////////////////////////
 
+#define TAR_NAME_SIZE	100
+
+static struct kmem_cache *tar_name_cache = NULL;
+
+////////////////////////////////////////////////////////////////////////////////
+
 static inline uint32_t __tar_getsize(struct tar_header *restrict file)
 {
 	uint32_t size = 0;
@@ -37,7 +44,7 @@ static inline uint32_t __tar_getsize(struct tar_header *restrict file)
 }
 
 static inline const char *__tar_filename(const char *restrict tar_path) {
-	char *name = kalloc(sizeof(*name) * 100);
+	char *name = kmem_cache_alloc(tar_name_cache);
 	char *n = name;
 	char *c = tar_path;
 
@@ -86,6 +93,12 @@ void parse_tar(
 	/* Allocate the appropriate memory and then construct a list of files to 
 	   pass back to the caller. */
 	if (files) {
+		if (!tar_name_cache) {
+			tar_name_cache = kmem_cache_create(
+				"tar name", sizeof(char) * TAR_NAME_SIZE, 0, NULL
+			);
+		}
+
 		if ((*files = kalloc(sizeof(**files) * count)) == NULL) {
 			klogc(serr, "Tarball files allocation failed!\n");
 			return;
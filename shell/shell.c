@@ -28,6 +28,17 @@
 #include <ramdisk.h>
 #include <display.h>
 #include <syscall.h>
+#include <pmm.h>
+#include <vmm.h>
+#include <paging.h>
+#include <slab.h>
+#include <heap.h>
+#include <vmalloc.h>
+#include <reserve.h>
+#include <reclaim.h>
+#include <context.h>
+#include <heapprof.h>
+#include <colorbench.h>
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -44,6 +55,12 @@ struct ksh_var
 static struct thread *kernel_shell_thread = NULL;
 static struct ksh_var *first_shell_variable = NULL;
 static struct ksh_var *last_shell_variable = NULL;
+static struct kmem_cache *ksh_var_cache = NULL;
+
+static const char *ksh_frame_purposes[frame_purpose_count] = {
+	"unknown", "available", "bios", "kernel code", "kernel wired", "module",
+	"video", "context", "paging"
+};
 
 static void ksh_parse_command(const char *restrict buffer, bool *exit);
 static void ksh_handle_command(uint8_t argc, const char **argv, bool *exit);
@@ -70,17 +87,18 @@ static void ksh_define_variable(
 	if (var) {
 		kfree(var->value);
 		var->value = kalloc(strlen(value) + 1);
-		memcpy(var->value, value, strlen(value));
+		memcpy(var->value, value, strlen(value) + 1);
 		return;
 	}
 
-	var = kalloc(sizeof(*var));
+	var = kmem_cache_alloc(ksh_var_cache);
 	var->id = kalloc(strlen(id) + 1);
 	var->value = kalloc(strlen(value) + 1);
 
-	memcpy(var->id, id, strlen(id));
-	memcpy(var->value, value, strlen(value));
+	memcpy(var->id, id, strlen(id) + 1);
+	memcpy(var->value, value, strlen(value) + 1);
 
+	var->next = NULL;
 	var->prev = last_shell_variable;
 	if (!first_shell_variable) {
 		first_shell_variable = var;
@@ -161,9 +179,108 @@ static void ksh_handle_command(uint8_t argc, const char **argv, bool *exit)
 			kprint("  set [name] [value]\n");
 		}
 	}
+	else if (strcmp(argv[0], "retain") == 0) {
+		/* retain low high - requires 2 arguments (argc == 3) */
+		if (argc == 3) {
+			heap_set_retention(
+				current_context()->heap, atoi(argv[1]), atoi(argv[2])
+			);
+		}
+		else {
+			kprint("Incorrect arguments provided.\n");
+			kprint("  retain [low] [high]\n");
+		}
+	}
+	else if (strcmp(argv[0], "heapprof") == 0) {
+		/* heapprof [dump] - the dump is written to the serial port. */
+#if defined(HEAP_PROFILE)
+		if (argc == 2 && strcmp(argv[1], "dump") == 0) {
+			heapprof_dump();
+		}
+		else {
+			heapprof_report();
+		}
+#else
+		kprint("The heap profiler is not included in this build.\n");
+		kprint("  Build with -DHEAP_PROFILE to include it.\n");
+#endif
+	}
+	else if (strcmp(argv[0], "colorbench") == 0) {
+		/* colorbench [pages] [passes] - both arguments are optional. */
+		colorbench_run(
+			(argc >= 2) ? atoi(argv[1]) : 0, (argc >= 3) ? atoi(argv[2]) : 0
+		);
+	}
 	else if (strcmp(argv[0], "clear") == 0) {
 		display_clear();
 	}
+	else if (strcmp(argv[0], "meminfo") == 0) {
+		for (uint32_t i = 0; i < frame_purpose_count; ++i) {
+			uint32_t count = pmm_frame_count(i);
+			kprint("%s: %d frames (%d KiB)\n", 
+				ksh_frame_purposes[i], count, count * (FRAME_SIZE >> 10));
+		}
+
+		struct pmm_color_stats colors;
+		pmm_get_color_stats(&colors);
+		kprint("colors: %d, %d frames held, %d hits, %d misses\n",
+			colors.colors, colors.held, colors.hits, colors.misses);
+
+		struct vmm_stats stats;
+		vmm_get_stats(&stats);
+		kprint("zero pool: %d frames, %d hits, %d misses\n",
+			stats.zero_pool_frames, stats.zero_pool_hits,
+			stats.zero_pool_misses);
+		kprint("zero page: %d mappings\n", stats.zero_page_mappings);
+
+		struct paging_tlb_stats tlb;
+		paging_get_tlb_stats(&tlb);
+		kprint("tlb: %d invalidations, %d full flushes (%d global), "
+			"%d batches (%d deferred)\n", tlb.invalidations,
+			tlb.full_flushes, tlb.global_flushes, tlb.batches, tlb.deferred);
+
+		const struct vmm_region *region;
+		for (uint32_t i = 0; (region = vmm_get_region(i)) != NULL; ++i) {
+			kprint("region %s (%p-%p): %d faults\n", region->name,
+				region->base, region->limit, region->faults);
+		}
+
+		struct heap *heap = current_context()->heap;
+		kprint("heap: %d blocks (%d free), %d pages retained (%d-%d), "
+			"%d trims (%d pages)\n", heap->block_count, heap->free_blocks,
+			heap->retained, heap->retain_low, heap->retain_high, heap->trims,
+			heap->trimmed);
+
+		struct vmalloc_stats large;
+		vmalloc_get_stats(&large);
+		kprint("large allocations: %d (%d pages)\n", large.areas, large.pages);
+
+		struct reserve_stats reserve;
+		reserve_get_stats(&reserve);
+		kprint("reserve: %d/%d/%d/%d objects, %d frames, %d hits, %d misses, "
+			"%d refills\n", reserve.objects[0], reserve.objects[1],
+			reserve.objects[2], reserve.objects[3], reserve.frames,
+			reserve.hits, reserve.misses, reserve.refills);
+
+		struct reclaim_stats reclaim;
+		reclaim_get_stats(&reclaim);
+		kprint("reclaim: %d background, %d direct (%d failed)\n",
+			reclaim.background, reclaim.direct, reclaim.failures);
+
+		const struct reclaim_shrinker *shrinker;
+		for (uint32_t i = 0; (shrinker = reclaim_get_shrinker(i)); ++i) {
+			kprint("shrinker %s: %d reclaimable, %d calls, %d frames freed\n",
+				shrinker->name, shrinker->count(shrinker->data),
+				shrinker->calls, shrinker->freed);
+		}
+
+		const struct kmem_cache *cache;
+		for (uint32_t i = 0; (cache = kmem_get_cache(i)) != NULL; ++i) {
+			kprint("cache %s: %d objects of %d bytes, %d slabs of %d pages\n",
+				cache->name, cache->objects, cache->size, cache->slabs,
+				cache->pages);
+		}
+	}
 	else {
 		char *script = ramdisk_open(&system_ramdisk, argv[0], NULL);
 		if (script) {
@@ -293,5 +410,8 @@ int kernel_shell_main(void)
 
 void launch_kernel_shell(void)
 {
+	ksh_var_cache = kmem_cache_create(
+		"ksh_var", sizeof(struct ksh_var), 0, NULL
+	);
 	kernel_shell_thread = thread_create(kernel_shell_main);
 }
\ No newline at end of file
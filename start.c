@@ -35,10 +35,23 @@
 #include <pci.h>
 #include <keyboard.h>
 #include <shell.h>
+#include <vmm.h>
+#include <reserve.h>
+#include <reclaim.h>
+#include <vmalloc.h>
 
 int kidle(void)
 {
-	while (1) hang();
+	/* Use idle time to reclaim memory when free frames are running low, to
+	   refill the emergency reserve and to prepare zeroed frames for later page
+	   acquisitions. Only halt once there is nothing left to do. */
+	while (1) {
+		if (!reclaim_background() && !reserve_refill()
+			&& !vmm_prepare_zeroed_frame()
+		) {
+			hang();
+		}
+	}
 }
 
 __attribute__((noreturn)) void kmain(void *mb, uint32_t boot_magic)
@@ -58,11 +71,16 @@ __attribute__((noreturn)) void kmain(void *mb, uint32_t boot_magic)
 	/* Initialise the hardware components of the system */
 	init_physical_memory(mb);
 	init_arch();
+#if defined(PAGE_COLORING)
+	pmm_set_frame_colors(arch_cache_colors());
+#endif
 	init_display();
 
 	/* Setup the kernel context. This will provide access to a heap and paging
 	   functionality in the short term. */
+	init_vmalloc();
 	init_context(&kernel_context);
+	init_reclaim();
 
 	/* Begin getting internal devices configured and ready for use such as PCI,
 	   hard drives, etc */
@@ -0,0 +1,62 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+/* The replay tool is single threaded, so heap locks are never contended and
+   do nothing. */
+
+#if !defined(LOCK_H)
+#define LOCK_H
+
+#include <types.h>
+
+struct spinlock
+{
+	volatile uint32_t locked;
+	uintptr_t flags;
+};
+
+static inline void spin_init(struct spinlock *lock)
+{
+	lock->locked = 0;
+	lock->flags = 0;
+}
+
+static inline void spin_lock(struct spinlock *lock)
+{
+	lock->locked = 1;
+}
+
+static inline bool spin_trylock(struct spinlock *lock)
+{
+	if (lock->locked) {
+		return false;
+	}
+	lock->locked = 1;
+	return true;
+}
+
+static inline void spin_unlock(struct spinlock *lock)
+{
+	lock->locked = 0;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,145 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+/* Stand-ins for the parts of the kernel that the heap depends upon. Only the
+   Virtual Memory Manager and logging are needed. The heap is placed in an
+   anonymous host mapping, so pages are acquired on demand the first time that
+   they are touched, just as they are in the kernel. Released pages are
+   discarded by the host, and read as zero the next time that they are
+   accessed. */
+
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <vmm.h>
+#include <print.h>
+#include "replay.h"
+
+#define REPLAY_PAGE_SIZE	0x1000
+
+uint32_t replay_pages_released = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+
+void kprint(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+void klog(const char *fmt, ...)
+{
+	(void)fmt;
+}
+
+void klogc(enum print_status status, const char *fmt, ...)
+{
+	if (status != serr && status != swarn) {
+		return;
+	}
+
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t replay_resident_pages(uintptr_t first, uintptr_t last)
+{
+	if (last <= first) {
+		return 0;
+	}
+
+	size_t count = (last - first) / REPLAY_PAGE_SIZE;
+	unsigned char *resident = malloc(count);
+	if (!resident || mincore((void *)first, last - first, resident) != 0) {
+		free(resident);
+		return 0;
+	}
+
+	uint32_t pages = 0;
+	for (size_t n = 0; n < count; ++n) {
+		pages += resident[n] & 1;
+	}
+	free(resident);
+	return pages;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+oserr vmm_create_region(const char *name, uintptr_t base, uintptr_t limit)
+{
+	(void)name;
+	return (base < limit) ? e_ok : e_fail;
+}
+
+uint32_t vmm_count_acquired(uintptr_t first, uintptr_t last)
+{
+	return replay_resident_pages(
+		first & ~(REPLAY_PAGE_SIZE - 1), last & ~(REPLAY_PAGE_SIZE - 1)
+	);
+}
+
+bool vmm_page_is_zero(uintptr_t linear)
+{
+	linear &= ~(REPLAY_PAGE_SIZE - 1);
+	return replay_resident_pages(linear, linear + REPLAY_PAGE_SIZE) == 0;
+}
+
+oserr vmm_acquire_page(uintptr_t linear)
+{
+	(void)linear;
+	return e_ok;
+}
+
+oserr vmm_acquire_pages(uintptr_t first, uintptr_t last)
+{
+	(void)first;
+	(void)last;
+	return e_ok;
+}
+
+oserr vmm_release_pages(uintptr_t first, uintptr_t last)
+{
+	first &= ~(REPLAY_PAGE_SIZE - 1);
+	last &= ~(REPLAY_PAGE_SIZE - 1);
+	if (last <= first) {
+		return e_ok;
+	}
+
+	replay_pages_released += replay_resident_pages(first, last);
+	if (madvise((void *)first, last - first, MADV_DONTNEED) != 0) {
+		return e_fail;
+	}
+	return e_ok;
+}
+
+oserr vmm_release_page(uintptr_t linear)
+{
+	linear &= ~(REPLAY_PAGE_SIZE - 1);
+	return vmm_release_pages(linear, linear + REPLAY_PAGE_SIZE);
+}
\ No newline at end of file
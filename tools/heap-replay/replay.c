@@ -0,0 +1,543 @@
+/*
+  Copyright (c) 2018-2019 Tom Hancocks
+  
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+  
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+  
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+ */
+
+/* Replays an allocation trace, recorded over the serial line by a kernel built
+   with ALLOC_TRACE, against the kernel heap running on the host. The serial
+   output can be captured with QEMU's -serial file:trace.bin option.
+
+   	make heap-replay
+   	build/heap-replay <trace> [heap size in MiB]
+
+   The trace may contain any other output from the serial line, which is
+   ignored. Each operation is timed individually, so the latencies include the
+   cost of reading the clock.
+
+   Requests are routed as the kernel routes them. Those of KALLOC_LARGE_SIZE
+   bytes or more are given whole pages of their own, which are mapped from the
+   host and counted separately from the heap. Everything else goes straight to
+   the heap. The per-thread magazines that the kernel keeps in front of the
+   heap for small allocations are not modelled, so small allocations and frees
+   reach the heap more often than they do in the kernel. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <heap.h>
+#include <alloc.h>
+#include <alloctrace.h>
+#include "replay.h"
+
+#define REPLAY_PAGE_SIZE		0x1000
+#define REPLAY_DEFAULT_HEAP		64
+#define REPLAY_SAMPLE_INTERVAL	1024
+
+/**
+ A single record from the trace.
+ 	- event		The kind of record.
+ 	- fields	The fields of the record, in the order that they were sent.
+ */
+struct replay_op
+{
+	uint8_t event;
+	uint32_t fields[3];
+};
+
+/**
+ A live allocation, mapping the address that the kernel returned to the address
+ that the replay received. An entry with an addr of 0 is empty.
+ */
+struct replay_entry
+{
+	uint32_t addr;
+	uint32_t size;
+	void *ptr;
+};
+
+static struct {
+	struct heap *heap;
+	struct replay_entry *live;
+	uint32_t capacity;
+	uint64_t live_bytes;
+	uint64_t peak_live_bytes;
+	uintptr_t peak_extent;
+	uint32_t peak_resident;
+	uint32_t large_allocs;
+	uint32_t large_pages;
+	uint32_t peak_large_pages;
+	uint64_t peak_footprint;
+	uint32_t failed;
+	uint32_t unmatched;
+	double worst_fragmentation;
+} replay;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t replay_read_field(const uint8_t *bytes)
+{
+	return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8)
+		| ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+/* Find every record in the trace. Anything that is not part of a record is
+   skipped, one byte at a time, until the next marker is found. */
+static struct replay_op *replay_parse(
+	const uint8_t *bytes, size_t length, uint32_t *count
+) {
+	struct replay_op *ops = malloc((length / 6 + 1) * sizeof(*ops));
+	if (!ops) {
+		return NULL;
+	}
+
+	*count = 0;
+	size_t offset = 0;
+	while (offset + 2 <= length) {
+		uint32_t fields = alloc_trace_fields(bytes[offset + 1]);
+		if (bytes[offset] != ALLOC_TRACE_MARKER || fields == 0
+			|| offset + 2 + fields * 4 > length
+		) {
+			offset++;
+			continue;
+		}
+
+		struct replay_op *op = &ops[(*count)++];
+		op->event = bytes[offset + 1];
+		for (uint32_t n = 0; n < 3; ++n) {
+			op->fields[n] = (n < fields)
+				? replay_read_field(&bytes[offset + 2 + n * 4])
+				: 0;
+		}
+		offset += 2 + fields * 4;
+	}
+	return ops;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline bool replay_is_large(uint32_t size)
+{
+	return size >= KALLOC_LARGE_SIZE;
+}
+
+static inline uint32_t replay_pages(uint32_t size)
+{
+	return (size + REPLAY_PAGE_SIZE - 1) / REPLAY_PAGE_SIZE;
+}
+
+/* Give a large allocation pages of its own, aligned to _align_ bytes if that is
+   larger than a page. The excess of the mapping is trimmed away. */
+static void *replay_map_pages(uint32_t size, uint32_t align)
+{
+	size_t length = (size_t)replay_pages(size) * REPLAY_PAGE_SIZE;
+	size_t extra = (align > REPLAY_PAGE_SIZE) ? align : 0;
+	uint8_t *map = mmap(
+		NULL, length + extra, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+	);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	uintptr_t start = (uintptr_t)map;
+	uintptr_t end = start + length + extra;
+	uintptr_t base = extra
+		? (start + align - 1) & ~(uintptr_t)(align - 1)
+		: start;
+	if (base > start) {
+		munmap(map, base - start);
+	}
+	if (end > base + length) {
+		munmap((void *)(base + length), end - (base + length));
+	}
+
+	replay.large_allocs++;
+	replay.large_pages += replay_pages(size);
+	replay.peak_large_pages = MAX(replay.peak_large_pages, replay.large_pages);
+	return (void *)base;
+}
+
+static void replay_release(void *ptr, uint32_t size)
+{
+	if (replay_is_large(size)) {
+		munmap(ptr, (size_t)replay_pages(size) * REPLAY_PAGE_SIZE);
+		replay.large_pages -= replay_pages(size);
+	}
+	else {
+		heap_dealloc(replay.heap, ptr);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t replay_hash(uint32_t addr)
+{
+	return ((addr >> 2) * 2654435761U) & (replay.capacity - 1);
+}
+
+static struct replay_entry *replay_find(uint32_t addr)
+{
+	uint32_t n = replay_hash(addr);
+	while (replay.live[n].addr) {
+		if (replay.live[n].addr == addr) {
+			return &replay.live[n];
+		}
+		n = (n + 1) & (replay.capacity - 1);
+	}
+	return NULL;
+}
+
+static void replay_remove(struct replay_entry *entry)
+{
+	replay.live_bytes -= entry->size;
+
+	/* Shift any entries that were displaced past this one back into the
+	   hole, so that a lookup never stops early at an empty entry. */
+	uint32_t hole = (uint32_t)(entry - replay.live);
+	uint32_t n = hole;
+	replay.live[hole].addr = 0;
+	for (;;) {
+		n = (n + 1) & (replay.capacity - 1);
+		if (!replay.live[n].addr) {
+			return;
+		}
+		uint32_t home = replay_hash(replay.live[n].addr);
+		if (((n - home) & (replay.capacity - 1))
+			>= ((n - hole) & (replay.capacity - 1))
+		) {
+			replay.live[hole] = replay.live[n];
+			replay.live[n].addr = 0;
+			hole = n;
+		}
+	}
+}
+
+static void replay_insert(uint32_t addr, uint32_t size, void *ptr)
+{
+	/* The kernel can only return an address that is live once, so an existing
+	   entry is from an allocation whose free was not recorded. */
+	struct replay_entry *entry = replay_find(addr);
+	if (entry) {
+		replay.unmatched++;
+		replay_release(entry->ptr, entry->size);
+		replay_remove(entry);
+	}
+
+	uint32_t n = replay_hash(addr);
+	while (replay.live[n].addr) {
+		n = (n + 1) & (replay.capacity - 1);
+	}
+	replay.live[n].addr = addr;
+	replay.live[n].size = size;
+	replay.live[n].ptr = ptr;
+
+	replay.live_bytes += size;
+	replay.peak_live_bytes = MAX(replay.peak_live_bytes, replay.live_bytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint64_t replay_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uintptr_t replay_extent(void)
+{
+	struct heap_block *last = replay.heap->last;
+	return (last->state == heap_block_free)
+		? (uintptr_t)last
+		: last->start + last->size;
+}
+
+/* Free memory that can not satisfy an allocation as large as the free memory
+   in total is fragmented. The free space beyond the last allocation is not
+   counted, as it is always available. */
+static double replay_fragmentation(void)
+{
+	uint64_t total = 0;
+	uint32_t largest = 0;
+	struct heap_block *block = replay.heap->first;
+	while (block && block != replay.heap->last) {
+		if (block->state == heap_block_free) {
+			total += block->size;
+			largest = MAX(largest, block->size);
+		}
+		block = block->next;
+	}
+	return total ? 1.0 - (double)largest / (double)total : 0.0;
+}
+
+static void replay_sample(void)
+{
+	uintptr_t first = replay.heap->base;
+	uintptr_t extent = replay_extent();
+	uintptr_t last = (extent + REPLAY_PAGE_SIZE - 1) & ~(REPLAY_PAGE_SIZE - 1);
+	replay.peak_resident = MAX(
+		replay.peak_resident, replay_resident_pages(first, last)
+	);
+
+	double fragmentation = replay_fragmentation();
+	if (fragmentation > replay.worst_fragmentation) {
+		replay.worst_fragmentation = fragmentation;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void replay_alloc(uint32_t addr, uint32_t size, void *ptr)
+{
+	if (!ptr) {
+		replay.failed++;
+		return;
+	}
+	replay_insert(addr, size, ptr);
+}
+
+/* A resize that involves a large allocation either keeps the same number of
+   pages, or moves the allocation to wherever its new size is routed. */
+static void *replay_realloc_pages(struct replay_entry *entry, uint32_t size)
+{
+	if (entry && size == 0) {
+		replay_release(entry->ptr, entry->size);
+		return NULL;
+	}
+	else if (entry && replay_is_large(entry->size) && replay_is_large(size)
+		&& replay_pages(entry->size) == replay_pages(size)
+	) {
+		return entry->ptr;
+	}
+
+	void *moved = replay_is_large(size)
+		? replay_map_pages(size, 0)
+		: heap_alloc(replay.heap, size);
+	if (moved && entry) {
+		memcpy(moved, entry->ptr, MIN(entry->size, size));
+		replay_release(entry->ptr, entry->size);
+	}
+	return moved;
+}
+
+static void replay_op(const struct replay_op *op)
+{
+	struct replay_entry *entry;
+	void *ptr;
+
+	switch (op->event) {
+		case alloc_trace_alloc:
+			ptr = replay_is_large(op->fields[0])
+				? replay_map_pages(op->fields[0], 0)
+				: heap_alloc(replay.heap, op->fields[0]);
+			replay_alloc(op->fields[1], op->fields[0], ptr);
+			break;
+
+		case alloc_trace_calloc:
+			ptr = replay_is_large(op->fields[0])
+				? replay_map_pages(op->fields[0], 0)
+				: heap_calloc(replay.heap, 1, op->fields[0]);
+			replay_alloc(op->fields[1], op->fields[0], ptr);
+			break;
+
+		case alloc_trace_aligned:
+			ptr = replay_is_large(op->fields[0])
+				? replay_map_pages(op->fields[0], op->fields[1])
+				: heap_alloc_aligned(replay.heap, op->fields[0], op->fields[1]);
+			replay_alloc(op->fields[2], op->fields[0], ptr);
+			break;
+
+		case alloc_trace_realloc:
+			entry = op->fields[0] ? replay_find(op->fields[0]) : NULL;
+			if (op->fields[0] && !entry) {
+				replay.unmatched++;
+				break;
+			}
+			if (replay_is_large(op->fields[1])
+				|| (entry && replay_is_large(entry->size))
+			) {
+				ptr = replay_realloc_pages(entry, op->fields[1]);
+			}
+			else {
+				ptr = heap_realloc(
+					replay.heap, entry ? entry->ptr : NULL, op->fields[1]
+				);
+			}
+			if (!ptr && op->fields[1]) {
+				replay.failed++;
+				break;
+			}
+			if (entry) {
+				replay_remove(entry);
+			}
+			if (ptr) {
+				replay_insert(op->fields[2], op->fields[1], ptr);
+			}
+			break;
+
+		case alloc_trace_free:
+			entry = replay_find(op->fields[0]);
+			if (!entry) {
+				replay.unmatched++;
+				break;
+			}
+			replay_release(entry->ptr, entry->size);
+			replay_remove(entry);
+			break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int replay_compare(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static uint8_t *replay_load(const char *path, size_t *length)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		return NULL;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	uint8_t *bytes = (size >= 0) ? malloc((size_t)size + 1) : NULL;
+	if (bytes && fread(bytes, 1, (size_t)size, file) != (size_t)size) {
+		free(bytes);
+		bytes = NULL;
+	}
+	fclose(file);
+
+	*length = (size_t)size;
+	return bytes;
+}
+
+int main(int argc, const char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <trace> [heap size in MiB]\n", argv[0]);
+		return 1;
+	}
+
+	size_t length = 0;
+	uint8_t *bytes = replay_load(argv[1], &length);
+	if (!bytes) {
+		fprintf(stderr, "Failed to read trace %s\n", argv[1]);
+		return 1;
+	}
+
+	uint32_t count = 0;
+	struct replay_op *ops = replay_parse(bytes, length, &count);
+	free(bytes);
+	if (!ops || count == 0) {
+		fprintf(stderr, "No allocation records found in %s\n", argv[1]);
+		return 1;
+	}
+
+	/* There can never be more live allocations than there are records, so a
+	   table of at least twice that size is never more than half full. */
+	replay.capacity = 16;
+	while (replay.capacity < count * 2) {
+		replay.capacity <<= 1;
+	}
+	replay.live = calloc(replay.capacity, sizeof(*replay.live));
+
+	size_t heap_size = (size_t)((argc > 2) ? atoi(argv[2])
+		: REPLAY_DEFAULT_HEAP) << 20;
+	void *region = mmap(
+		NULL, heap_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+	);
+	if (!replay.live || heap_size == 0 || region == MAP_FAILED) {
+		fprintf(stderr, "Failed to reserve a heap of %zu bytes\n", heap_size);
+		return 1;
+	}
+
+	uintptr_t base = (uintptr_t)region;
+	if (init_heap(&replay.heap, base, base + heap_size) != e_ok) {
+		return 1;
+	}
+
+	uint32_t *latency = malloc(count * sizeof(*latency));
+	if (!latency) {
+		return 1;
+	}
+
+	/* Sampling the resident pages and fragmentation is expensive, so it is
+	   done periodically and is not included in the timings. */
+	uint64_t elapsed = 0;
+	for (uint32_t n = 0; n < count; ++n) {
+		uint64_t start = replay_now();
+		replay_op(&ops[n]);
+		latency[n] = (uint32_t)(replay_now() - start);
+		elapsed += latency[n];
+
+		uintptr_t extent = replay_extent() - base;
+		if (extent > replay.peak_extent) {
+			replay.peak_extent = extent;
+		}
+		uint64_t footprint = extent
+			+ (uint64_t)replay.large_pages * REPLAY_PAGE_SIZE;
+		replay.peak_footprint = MAX(replay.peak_footprint, footprint);
+		if ((n % REPLAY_SAMPLE_INTERVAL) == 0) {
+			replay_sample();
+		}
+	}
+	replay_sample();
+	qsort(latency, count, sizeof(*latency), replay_compare);
+
+	printf("operations:         %u\n", count);
+	printf("failed:             %u\n", replay.failed);
+	printf("unmatched:          %u\n", replay.unmatched);
+	printf("throughput:         %.0f ops/s\n",
+		elapsed ? (double)count * 1e9 / (double)elapsed : 0.0);
+	printf("latency p50:        %u ns\n", latency[count / 2]);
+	printf("latency p99:        %u ns\n", latency[(count * 99ULL) / 100]);
+	printf("latency max:        %u ns\n", latency[count - 1]);
+	printf("peak live:          %llu bytes\n",
+		(unsigned long long)replay.peak_live_bytes);
+	printf("peak footprint:     %llu bytes\n",
+		(unsigned long long)replay.peak_footprint);
+	printf("peak heap extent:   %llu bytes (%u resident pages)\n",
+		(unsigned long long)replay.peak_extent, replay.peak_resident);
+	printf("large allocations:  %u (peak %u pages)\n",
+		replay.large_allocs, replay.peak_large_pages);
+	printf("footprint overhead: %.2fx\n",
+		replay.peak_live_bytes
+			? (double)replay.peak_footprint / (double)replay.peak_live_bytes
+			: 0.0);
+	printf("fragmentation:      %.1f%% final, %.1f%% worst\n",
+		replay_fragmentation() * 100.0, replay.worst_fragmentation * 100.0);
+	printf("pages released:     %u\n", replay_pages_released);
+
+	free(latency);
+	free(ops);
+	free(replay.live);
+	munmap(region, heap_size);
+	return 0;
+}
\ No newline at end of file